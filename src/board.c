@@ -9,66 +9,77 @@
 
 #include "board.h"
 
+//The hot functions are written once against a side that's a constant, and
+//  forced inline into a white and a black version of each public function,
+//  so the compiler folds away every (white) ? ... : ... in them. The public
+//  function picks a version once per call, and the versions call each other
+//  directly
+#define SIDE_INLINE static inline __attribute__((always_inline))
+
+//Side versions used before they're defined
+SIDE_INLINE
+uint8_t generatePieceMovesSide(chessboard * const board, const bool white,
+        uint8_t from, uint8_t kinds, checkinfo * const checks,
+        chessmove moves[], uint8_t count);
+SIDE_INLINE
+bool makeMoveSide(uint8_t from, uint8_t location, const bool white,
+        chessboard * const current, chessboard * new);
+SIDE_INLINE
+void moveSpecialSide(uint8_t from, uint8_t location, const bool white,
+        chessboard * const current, chessboard * new, uint8_t promote_to);
+
 /*
  * Initializes the board to its base state, where no moves have been made yet
  *
- * @uses white_initial, black_initial, location_bitboards, w_codes, b_codes
+ * @uses white_initial, black_initial, location_boards, w_codes, b_codes,
+ *       piece_square_vals
  *
  * @param board The chessboard to initialize.
  */
 void initBoard(chessboard * board)
 {
-    //Set up the occupation bitboards for all white/black pieces
-    //White pieces are in positions 0-15 -> low 16 bits on
+    //Nothing anywhere until the pieces are placed
+    memset(board->pieces, 0, sizeof(board->pieces));
     board->all_w_pieces = 0;
-    //Black pieces are in positions 48-63 -> low 48 off
     board->all_b_pieces = 0;
+    memset(board->squares, 0xFF, sizeof(board->squares));
 
     //none of the rooks or the king has moved yet
-    board->w_cancastle = KINGSIDE_ROOK | QUEENSIDE_ROOK;
-    board->b_cancastle = KINGSIDE_ROOK | QUEENSIDE_ROOK;
-
-    //No squares free between king and rooks
-    board->w_castlefree = 0;
-    board->b_castlefree = 0;
+    board->state.w_cancastle = KINGSIDE_ROOK | QUEENSIDE_ROOK;
+    board->state.b_cancastle = KINGSIDE_ROOK | QUEENSIDE_ROOK;
 
     //Initially no identical moves
-    board->b_ident_moves = 0;
-    board->w_ident_moves = 0;
-    //No last piece moved
-    board->w_last_piece = UINT8_MAX;
-    board->b_last_piece = UINT8_MAX;
-    //No position moved to
-    board->w_last_move = INVALID_SQUARE;
-    board->b_last_move = INVALID_SQUARE;
-    board->w_last_move2 = INVALID_SQUARE;
-    board->b_last_move2 = INVALID_SQUARE;
-
-    //Set location arrays
-    memcpy(board->w_piece_posns, white_initial, 16 * sizeof(uint8_t));
-    memcpy(board->b_piece_posns, black_initial, 16 * sizeof(uint8_t));
-
-    //Set initial piece codes
-    memcpy(board->w_codes, w_codes, 16 * sizeof(uint8_t));
-    memcpy(board->b_codes, b_codes, 16 * sizeof(uint8_t));
-
-    //Set location bitboards
+    board->state.b_ident_moves = 0;
+    board->state.w_ident_moves = 0;
+    //No position moved from or to
+    board->state.w_last_from = INVALID_SQUARE;
+    board->state.b_last_from = INVALID_SQUARE;
+    board->state.w_last_move = INVALID_SQUARE;
+    board->state.b_last_move = INVALID_SQUARE;
+    board->state.w_last_move2 = INVALID_SQUARE;
+    board->state.b_last_move2 = INVALID_SQUARE;
+
+    //Place the pieces
     for (uint8_t i = 0; i < 16; ++i)
     {
-        board->w_locations[i] = location_boards[board->w_piece_posns[i]];
-        board->b_locations[i] = location_boards[board->b_piece_posns[i]];
+        board->pieces[w_codes[i]] |= location_boards[white_initial[i]];
+        board->pieces[b_codes[i] % B_P] |= location_boards[black_initial[i]];
         //Update population bitboard
-        board->all_w_pieces |= board->w_locations[i];
-        board->all_b_pieces |= board->b_locations[i];
+        board->all_w_pieces |= location_boards[white_initial[i]];
+        board->all_b_pieces |= location_boards[black_initial[i]];
+        SET_PIECE_AT(board, white_initial[i], w_codes[i]);
+        SET_PIECE_AT(board, black_initial[i], b_codes[i]);
     }
 
+    board->key = hashBoard(board);
+    board->state.value[0] = (int16_t) sumPieceSquares(board, false);
+    board->state.value[1] = (int16_t) sumPieceSquares(board, true);
+    board->state.phase = gamePhase(board);
+
 #ifdef DEBUG_INIT
-    for (uint8_t i = 0; i < 16; ++i)
+    for (uint8_t i = 0; i < 6; ++i)
     {
-        fprintf(stdout, "w%d: %d\n", i, board->w_piece_posns[i]);
-        fprintf(stdout, "wloc%d: %llx\n", i, board->w_locations[i]);
-        fprintf(stdout, "b%d: %d\n", i, board->b_piece_posns[i]);
-        fprintf(stdout, "bloc%d: %llx\n", i, board->b_locations[i]);
+        fprintf(stdout, "pieces%d: %llx\n", i, board->pieces[i]);
     }
     fprintf(stdout, "woc: %llx\n", board->all_w_pieces);
     fprintf(stdout, "boc: %llx\n", board->all_b_pieces);
@@ -76,178 +87,688 @@ void initBoard(chessboard * board)
 }
 
 /*
- * Expands the set of all possible board states from an initial state
+ * attackersOf() for a side fixed at compile time, see SIDE_INLINE
+ */
+SIDE_INLINE
+bitboard attackersOfSide(chessboard * const board, uint8_t sq, const bool white,
+        bitboard occupied)
+{
+    bitboard side = (white) ? board->all_w_pieces : board->all_b_pieces;
+    bitboard target = location_boards[sq];
+    bitboard pawns;
+
+    //Look out from the square as each kind of piece, anything of that kind
+    //  found attacks it. Pawns attack diagonally forward, so a white pawn is
+    //  diagonally behind the square and a black pawn diagonally ahead
+    if (white)
+    {
+        pawns = ((target >> 7) & ~FILE_A) | ((target >> 9) & ~FILE_H);
+    }
+    else
+    {
+        pawns = ((target << 7) & ~FILE_H) | ((target << 9) & ~FILE_A);
+    }
+
+    return (side & ((pawns & board->pieces[W_P])
+            | (attacked_squares[W_N][sq] & board->pieces[W_N])
+            | (attacked_squares[W_K][sq] & board->pieces[W_K])
+            | (ROOK_ATTACKS(sq, occupied)
+                    & (board->pieces[W_R] | board->pieces[W_Q]))
+            | (BISHOP_ATTACKS(sq, occupied)
+                    & (board->pieces[W_B] | board->pieces[W_Q]))));
+}
+
+/*
+ * Finds the pieces of a side that attack a square
  *
- * @uses location_boards, legal_moves
+ * @uses attacked_squares, rook_attacks, bishop_attacks
  *
- * @param board A pointer to the board to expand
- * @param storage A pointer to an array in which to store the expanded states
- *         !!This pointer will be realloc'd to fit the set of expanded states!!
- * @param white true if expanding the set of white moves
- * @return The number of states expanded
+ * @param board The board to look at
+ * @param sq The square attacked
+ * @param white true if looking for white's attackers
+ * @param occupied The squares that block sliders, usually every piece
+ * @return A bitboard of the locations of the attacking pieces
  */
-uint8_t expandStates(chessboard * const board, boardset * storage, bool white)
+bitboard attackersOf(chessboard * const board, uint8_t sq, bool white,
+        bitboard occupied)
+{
+    return ((white) ? attackersOfSide(board, sq, true, occupied)
+            : attackersOfSide(board, sq, false, occupied));
+}
+
+/*
+ * Finds the squares strictly between two squares on a rank, file or diagonal
+ *
+ * @uses attacked_squares, rook_attacks, bishop_attacks
+ *
+ * @param a One end of the line
+ * @param b The other end of the line
+ * @return The squares between a and b, 0 if they don't share a line
+ */
+bitboard squaresBetween(uint8_t a, uint8_t b)
+{
+    //Each end blocks the other, so only the squares between are attacked
+    //  from both
+    if (attacked_squares[W_R][a] & location_boards[b])
+    {
+        return (ROOK_ATTACKS(a, location_boards[b])
+                & ROOK_ATTACKS(b, location_boards[a]));
+    }
+    if (attacked_squares[W_B][a] & location_boards[b])
+    {
+        return (BISHOP_ATTACKS(a, location_boards[b])
+                & BISHOP_ATTACKS(b, location_boards[a]));
+    }
+
+    return (0);
+}
+
+/*
+ * Finds the whole rank, file or diagonal through two squares
+ *
+ * @uses attacked_squares
+ *
+ * @param a A square on the line
+ * @param b Another square on the line
+ * @return The squares of the line, 0 if a and b don't share one
+ */
+bitboard squaresInLine(uint8_t a, uint8_t b)
+{
+    bitboard ends = location_boards[a] | location_boards[b];
+
+    //On an empty board the two squares see each other's line, and any other
+    //  line through one crosses the other's lines only at the ends
+    if (attacked_squares[W_R][a] & location_boards[b])
+    {
+        return ((attacked_squares[W_R][a] & attacked_squares[W_R][b]) | ends);
+    }
+    if (attacked_squares[W_B][a] & location_boards[b])
+    {
+        return ((attacked_squares[W_B][a] & attacked_squares[W_B][b]) | ends);
+    }
+
+    return (0);
+}
+
+/*
+ * findChecks() for a side fixed at compile time, see SIDE_INLINE
+ */
+SIDE_INLINE
+void findChecksSide(chessboard * const board, const bool white,
+        checkinfo * checks)
+{
+    bitboard self = (white) ? board->all_w_pieces : board->all_b_pieces;
+    bitboard op = (white) ? board->all_b_pieces : board->all_w_pieces;
+    bitboard occupied = self | op;
+    uint8_t king = (uint8_t) __builtin_ctzll(board->pieces[W_K] & self);
+    bitboard snipers, blockers;
+    uint8_t pos;
+
+    checks->king = king;
+    checks->checkers = attackersOfSide(board, king, !white, occupied);
+    checks->pinned = 0;
+
+    //A single check can be blocked or captured, a double check only run
+    //  away from
+    if (!checks->checkers)
+    {
+        checks->evasions = ~(bitboard) 0;
+    }
+    else if (checks->checkers & (checks->checkers - 1))
+    {
+        checks->evasions = 0;
+    }
+    else
+    {
+        checks->evasions = checks->checkers
+                | squaresBetween(king,
+                        (uint8_t) __builtin_ctzll(checks->checkers));
+    }
+
+    //A slider lined up with the king with just one of our pieces between
+    //  pins that piece
+    snipers = op & ((attacked_squares[W_R][king]
+            & (board->pieces[W_R] | board->pieces[W_Q]))
+            | (attacked_squares[W_B][king]
+                    & (board->pieces[W_B] | board->pieces[W_Q])));
+    while (snipers)
+    {
+        pos = (uint8_t) __builtin_ctzll(snipers);
+        snipers &= snipers - 1;
+
+        blockers = squaresBetween(king, pos) & occupied;
+        if (blockers && !(blockers & (blockers - 1)) && (blockers & self))
+        {
+            checks->pinned |= blockers;
+        }
+    }
+}
+
+/*
+ * Works out the checks and pins that limit a side's moves
+ *
+ * @uses attacked_squares, rook_attacks, bishop_attacks
+ *
+ * @param board The board to look at
+ * @param white true if finding the checks against white
+ * @param checks Filled with the checkers, evasions and pins
+ */
+void findChecks(chessboard * const board, bool white, checkinfo * checks)
+{
+    if (white)
+    {
+        findChecksSide(board, true, checks);
+    }
+    else
+    {
+        findChecksSide(board, false, checks);
+    }
+}
+
+/*
+ * inCheck() for a side fixed at compile time, see SIDE_INLINE
+ */
+SIDE_INLINE
+bool inCheckSide(chessboard * const board, const bool white)
+{
+    bitboard self = (white) ? board->all_w_pieces : board->all_b_pieces;
+    uint8_t king = (uint8_t) __builtin_ctzll(board->pieces[W_K] & self);
+
+    return (attackersOfSide(board, king, !white,
+            board->all_w_pieces | board->all_b_pieces) != 0);
+}
+
+/*
+ * Checks if a side's king is attacked
+ *
+ * @uses attacked_squares, rook_attacks, bishop_attacks
+ *
+ * @param board The board to look at
+ * @param white true if checking white's king
+ * @return true if the king is in check
+ */
+bool inCheck(chessboard * const board, bool white)
+{
+    return ((white) ? inCheckSide(board, true)
+            : inCheckSide(board, false));
+}
+
+/*
+ * Checks if a side has any legal move, if not it's checkmated when in check
+ *  and stalemated otherwise
+ *
+ * @uses location_boards, legal_moves, rook_attacks, bishop_attacks
+ *
+ * @param board The board to look at
+ * @param white true if checking white's moves
+ * @return true if the side can move
+ */
+bool hasLegalMoves(chessboard * const board, bool white)
+{
+    chessmove moves[MAX_MOVES];
+    checkinfo checks;
+
+    findChecks(board, white, &checks);
+    return (generateMoves(board, white, GEN_ALL, &checks, moves) != 0);
+}
+
+/*
+ * generateMoves() for a side fixed at compile time, see SIDE_INLINE
+ */
+SIDE_INLINE
+uint8_t generateMovesSide(chessboard * const board, const bool white,
+        uint8_t kinds, checkinfo * const checks, chessmove moves[])
+{
+    bitboard self = (white) ? board->all_w_pieces : board->all_b_pieces;
+    bitboard pieces;
+
+    //Number of moves generated
+    uint8_t count = 0;
+
+    //For each piece, get the set of moves it can make from its location
+    //  Traverse from king to pawns, because maybe this helps alphabeta
+    uint8_t i = W_K;
+    do
+    {
+        pieces = board->pieces[i] & self;
+        while (pieces)
+        {
+            count = generatePieceMovesSide(board, white,
+                    (uint8_t) __builtin_ctzll(pieces), kinds, checks, moves,
+                    count);
+            pieces &= pieces - 1;
+        }
+    } while (i--);
+
+    return (count);
+}
+
+/*
+ * Generates the legal packed moves that can be made from a board
+ *
+ * @uses location_boards, legal_moves, rook_attacks, bishop_attacks
+ *
+ * @param board A pointer to the board to generate moves for
+ * @param white true if generating white's moves
+ * @param kinds Which moves to generate, GEN_CAPTURES and/or GEN_QUIETS
+ * @param checks The checks against the side, from findChecks()
+ * @param moves An array of at least MAX_MOVES moves to fill
+ * @return The number of moves generated
+ */
+uint8_t generateMoves(chessboard * const board, bool white, uint8_t kinds,
+        checkinfo * const checks, chessmove moves[])
+{
+    return ((white) ? generateMovesSide(board, true, kinds, checks, moves)
+            : generateMovesSide(board, false, kinds, checks, moves));
+}
+
+/*
+ * generatePieceMoves() for a side fixed at compile time, see SIDE_INLINE
+ */
+SIDE_INLINE
+uint8_t generatePieceMovesSide(chessboard * const board, const bool white,
+        uint8_t from, uint8_t kinds, checkinfo * const checks,
+        chessmove moves[], uint8_t count)
 {
     //Select the appropriate sets of data
-    //Piece locations
-    uint8_t * pieces = (white) ? board->w_piece_posns : board->b_piece_posns;
     //Side location occupancy boards
     bitboard self = (white) ? board->all_w_pieces : board->all_b_pieces;
     bitboard op = (white) ? board->all_b_pieces : board->all_w_pieces;
-    //Lookup table piece codes
-    uint8_t * codes = (white) ? board->w_codes : board->b_codes;
-
-    //Number of states generated
-    uint8_t states = 0;
+    //Lookup table piece code
+    uint8_t code = PIECE_AT(board, from);
+    bool king = (code % B_P == W_K);
+    //Squares the piece may move to without leaving the king in check, the
+    //  king checks its own squares as it goes
+    bitboard allowed = (king) ? ~(bitboard) 0 : checks->evasions;
+    //The king isn't there to block attacks along the line it moves away on
+    bitboard occupied = (self | op) & ~location_boards[from];
 
     //Used to check for castling
     uint8_t cancastle, castlefree;
     uint8_t castleto;
 
     //The set of moves
-    uint8_t (*moves)[7];
+    uint8_t (*rays)[7];
+    bitboard targets;
+    uint8_t to;
+    uint8_t flags;
 
-    bool capped;
+    //Loop variables
+    uint8_t j, k;
+
+    assert(location_boards[from] & self);
+#ifdef DEBUG_MOVE
+    fprintf(stdout, "piece: %d, @%d\n", code, from);
+    fprintf(stdout, "move0: %d\n", legal_moves[code][from][0][0]);
+#endif
 
-    if (storage->count < 35)
+    //A pinned piece can only move along the pin
+    if (checks->pinned & location_boards[from])
     {
-        //Allocate enough storage
-        storage->data = realloc(storage->data, 35 * sizeof(chessboard));
-        storage->count = 35;
+        allowed &= squaresInLine(checks->king, from);
+    }
+    if (!allowed)
+    {
+        return (count);
     }
 
-    //Loop variables
-    uint8_t i = 15;
-    uint8_t j, k;
-
-    //For each piece, get the set of moves it can make from its location
-    //  Traverse from king to pawns, because maybe this helps alphabeta
-    do
+    //Sliders look up everything they attack at once, and can move to
+    //  any of it that isn't one of our own pieces
+    switch (code % B_P)
+    {
+        case W_R:
+            targets = ROOK_ATTACKS(from, self | op);
+            break;
+        case W_B:
+            targets = BISHOP_ATTACKS(from, self | op);
+            break;
+        case W_Q:
+            targets = ROOK_ATTACKS(from, self | op)
+                    | BISHOP_ATTACKS(from, self | op);
+            break;
+        default:
+            targets = 0;
+            break;
+    }
+    if (targets)
     {
-        //Check if piece is captured
-        if (pieces[i] == CAPTURED)
+        targets &= ~self & allowed;
+        if (!(kinds & GEN_CAPTURES))
+        {
+            targets &= ~op;
+        }
+        if (!(kinds & GEN_QUIETS))
         {
-            continue;
+            targets &= op;
         }
+        while (targets)
+        {
+            to = (uint8_t) __builtin_ctzll(targets);
+            targets &= targets - 1;
+            moves[count++] = MOVE_FLAGGED(from, to,
+                    (location_boards[to] & op) ? MOVE_CAPTURE : 0);
+        }
+        return (count);
+    }
+
+    rays = legal_moves[code][from];
 
-        assert(i < 16);
+    //Go through each move ray
+    for (j = 0; j < 8; ++j)
+    {
+        //Go through each move in ray
+        for (k = 0; k < 7; ++k)
+        {
+            to = rays[j][k];
 #ifdef DEBUG_MOVE
-        fprintf(stdout, "index: %d\n", (int) i);
-        fprintf(stdout, "piece: %d, @%d\n", codes[i], pieces[i]);
-        fprintf(stdout, "move0: %d\n", legal_moves[codes[i]][pieces[i]][0][0]);
+            fprintf(stdout, "making move: %d\n", to);
 #endif
+            if (invalidMoveSimple(location_boards[to], self, op, code,
+                    j == 0))
+            {
+                //Stop looking through ray
+                break;
+            }
 
-        moves = legal_moves[codes[i]][pieces[i]];
+            flags = (location_boards[to] & op) ? MOVE_CAPTURE : 0;
 
-        //Go through each move ray
-        for (j = 0; j < 8; ++j)
-        {
-            capped = false;
-            //Go through each move in ray
-            for (k = 0; k < 7; ++k)
+            //Pawn promotion is a result of the move, rather than a
+            //  unique move, so just make it a queen
+            if (((code == W_P) && ((to / 8) == 7))
+                    || ((code == B_P) && ((to / 8) == 0)))
             {
-#ifdef DEBUG_MOVE
-                fprintf(stdout, "making move: %d\n", moves[j][k]);
-#endif
-                if(invalidMoveSimple(location_boards[moves[j][k]], self, op,
-                    codes[i], j == 0))
-                {
-                    //Stop looking through ray
-#ifdef DEBUG_MOVE
-                    puts("breaking");
-#endif
-                    break;
-                }
-                else
-                {
-                    //Expand special moves, do pawn promotion here as it's a
-                    //  result of the move, rather than a unique move
-                    if (((codes[i] == W_P) && ((moves[j][k] / 8) == 7))
-                            || ((codes[i] == B_P) && ((moves[j][k] / 8) == 0)))
-                    {
-                        //pawn promotion, just make it a queen
-                        moveSpecial(i, moves[j][k], white, board,
-                                &storage->data[states++], (white) ? W_Q : B_Q);
-                    }
-                    else
-                    {
-                        //Make the move with the piece
-                        capped = makeMove(i, moves[j][k], white, board,
-                                &storage->data[states++]);
-                    }
-
-                    if (storage->count <= states)
-                    {
-                        //Allocate more storage
-                        storage->count += 10;
-                        storage->data = realloc(storage->data,
-                                storage->count * sizeof(chessboard));
-                    }
-
-                    //See if this was a capturing move, and stop moving along
-                    //  ray if so
-                    if (capped)
-                    {
-                        break;
-                    }
-                }
-                //End making legal moves in ray
+                flags |= MOVE_PROMOTION | PROMOTE_Q;
             }
-            //End piece ray traversals
-            //do castling here
-            if ((codes[i] == W_K && board->w_cancastle && board->w_castlefree)
-                    || (codes[i] == B_K && board->b_cancastle
-                            && board->b_castlefree))
+
+            //Captures & promotions change the material, everything else is
+            //  quiet. Only legal moves are kept, but the ray goes on past an
+            //  illegal square
+            if ((kinds & ((flags) ? GEN_CAPTURES : GEN_QUIETS))
+                    && (location_boards[to] & allowed)
+                    && !(king && attackersOfSide(board, to, !white, occupied)))
             {
-                //Check if squares matching unoccupied space are free
-                cancastle = (white) ? board->w_cancastle : board->b_cancastle;
-                castlefree =
-                        (white) ? board->w_castlefree : board->b_castlefree;
+                moves[count++] = MOVE_FLAGGED(from, to, flags);
+            }
 
-                if ((cancastle & KINGSIDE_ROOK)
-                        && ((castlefree & KINGSIDE_FREE) == KINGSIDE_FREE))
-                {
-                    castleto = (white) ? KINGSIDE_W_CASTLE : KINGSIDE_B_CASTLE;
-                    //Do the castling, king to g1 or g1
-                    moveSpecial(i, castleto, white, board,
-                            &storage->data[states++], 0);
-                    if (storage->count <= states)
-                    {
-                        //Allocate more storage
-                        storage->count += 10;
-                        storage->data = realloc(storage->data,
-                                storage->count * sizeof(chessboard));
-                    }
-#ifdef DEBUG_MOVE
-                    fprintf(stdout, "castled kingside: %d, %x\n", cancastle, castlefree);
-                    printBoard(&storage->data[states-1]);
-#endif
-                }
-                if ((cancastle & QUEENSIDE_ROOK)
-                        && ((castlefree & QUEENSIDE_FREE) == QUEENSIDE_FREE))
-                {
-                    castleto =
-                            (white) ? QUEENSIDE_W_CASTLE : QUEENSIDE_B_CASTLE;
-                    moveSpecial(i, castleto, white, board,
-                            &storage->data[states++], 0);
-                    if (storage->count <= states)
-                    {
-                        //Allocate more storage
-                        storage->count += 10;
-                        storage->data = realloc(storage->data,
-                                storage->count * sizeof(chessboard));
-                    }
-#ifdef DEBUG_MOVE
-                    fprintf(stdout, "castled queenside: %d, %x\n", cancastle,
-                            castlefree);
-                    printBoard(&storage->data[states-1]);
-#endif
-                }
+            //See if this was a capturing move, and stop moving along
+            //  ray if so
+            if (flags & MOVE_CAPTURE)
+            {
+                break;
             }
+            //End making legal moves in ray
+        }
+        //End piece ray traversals
+    }
+
+    //do castling here, never out of check
+    cancastle = (white) ? board->state.w_cancastle : board->state.b_cancastle;
+    if ((kinds & GEN_QUIETS) && king && cancastle && !checks->checkers)
+    {
+        //Check if squares matching unoccupied space are free, the bits of
+        //  the empty squares on the back rank
+        castlefree = (uint8_t) ~((self | op) >> ((white) ? 0 : 56));
+
+        //The king can't pass through or land on an attacked square
+        if ((cancastle & KINGSIDE_ROOK)
+                && ((castlefree & KINGSIDE_FREE) == KINGSIDE_FREE)
+                && !attackersOfSide(board, from + 1, !white, self | op)
+                && !attackersOfSide(board, from + 2, !white, self | op))
+        {
+            //Castle the king to g1 or g8
+            castleto = (white) ? KINGSIDE_W_CASTLE : KINGSIDE_B_CASTLE;
+            moves[count++] = MOVE_FLAGGED(from, castleto, MOVE_CASTLE);
         }
-    } while(i--);
+        if ((cancastle & QUEENSIDE_ROOK)
+                && ((castlefree & QUEENSIDE_FREE) == QUEENSIDE_FREE)
+                && !attackersOfSide(board, from - 1, !white, self | op)
+                && !attackersOfSide(board, from - 2, !white, self | op))
+        {
+            //Castle the king to c1 or c8
+            castleto = (white) ? QUEENSIDE_W_CASTLE : QUEENSIDE_B_CASTLE;
+            moves[count++] = MOVE_FLAGGED(from, castleto, MOVE_CASTLE);
+        }
+    }
+
+    return (count);
+}
+
+/*
+ * Generates the packed moves that one piece can make, adding them after the
+ *  moves already generated
+ *
+ * @uses location_boards, legal_moves, rook_attacks, bishop_attacks
+ *
+ * @param board A pointer to the board to generate moves for
+ * @param white true if generating white's moves
+ * @param from The square of the piece, which must be one of the side's
+ * @param kinds Which moves to generate, GEN_CAPTURES and/or GEN_QUIETS
+ * @param checks The checks against the side, from findChecks()
+ * @param moves The array of moves to add to
+ * @param count The number of moves already in moves
+ * @return The number of moves in moves after the piece's are added
+ */
+uint8_t generatePieceMoves(chessboard * const board, bool white,
+        uint8_t from, uint8_t kinds, checkinfo * const checks,
+        chessmove moves[], uint8_t count)
+{
+    return ((white) ? generatePieceMovesSide(board, true, from, kinds, checks,
+            moves, count)
+            : generatePieceMovesSide(board, false, from, kinds, checks, moves,
+                    count));
+}
+
+/*
+ * Checks that a move from somewhere else, like the transposition table or a
+ *  killer slot, can be made on a board. Only the moving piece's moves are
+ *  generated to check against.
+ *
+ * @param board The board to check the move against
+ * @param white true if the move would be white's
+ * @param checks The checks against the side, from findChecks()
+ * @param mv The move to check
+ * @return true if generateMoves() would generate mv for the board
+ */
+bool validMove(chessboard * const board, bool white,
+        checkinfo * const checks, chessmove mv)
+{
+    chessmove moves[MAX_PIECE_MOVES];
+    bitboard self = (white) ? board->all_w_pieces : board->all_b_pieces;
+    uint8_t count;
+
+    if (!(location_boards[MOVE_FROM(mv)] & self))
+    {
+        return (false);
+    }
+
+    count = generatePieceMoves(board, white, MOVE_FROM(mv),
+            (MOVE_FLAGS(mv) & (MOVE_CAPTURE | MOVE_PROMOTION)) ?
+                    GEN_CAPTURES : GEN_QUIETS, checks, moves, 0);
+    for (uint8_t i = 0; i < count; ++i)
+    {
+        if (moves[i] == mv)
+        {
+            return (true);
+        }
+    }
+
+    return (false);
+}
+
+/*
+ * Expands the set of all possible board states from an initial state
+ *
+ * @uses location_boards, legal_moves
+ *
+ * @param board A pointer to the board to expand
+ * @param storage The array to store the expanded states in, with room for
+ *                every move
+ * @param white true if expanding the set of white moves
+ * @return The number of states expanded
+ */
+uint8_t expandStates(chessboard * const board, boardset * storage, bool white)
+{
+    chessmove moves[MAX_MOVES];
+    checkinfo checks;
+    uint8_t states;
+
+    findChecks(board, white, &checks);
+    states = generateMoves(board, white, GEN_ALL, &checks, moves);
+
+    return (expandMoves(board, storage, white, moves, states));
+}
+
+/*
+ * Makes each of a list of moves on a copy of a board
+ *
+ * @param board A pointer to the board to make the moves from
+ * @param storage The array to store the new states in, with room for count
+ *                states
+ * @param white true if the moves are white's
+ * @param moves The moves to make
+ * @param count The number of moves
+ * @return The number of states made, count
+ */
+uint8_t expandMoves(chessboard * const board, boardset * storage, bool white,
+        chessmove moves[], uint8_t count)
+{
+    undoinfo undo;
+
+    //The storage is allocated up front with room for every move
+    assert(storage->count >= count);
+
+    for (uint8_t i = 0; i < count; ++i)
+    {
+        memcpy(&storage->data[i], board, sizeof(chessboard));
+        doMove(&storage->data[i], moves[i], white, &undo);
+    }
+
+    return (count);
+}
+
+/*
+ * doMove() for a side fixed at compile time, see SIDE_INLINE
+ */
+SIDE_INLINE
+void doMoveSide(chessboard * board, chessmove mv, const bool white,
+        undoinfo * undo)
+{
+    uint8_t from = MOVE_FROM(mv);
+    uint8_t to = MOVE_TO(mv);
+    uint8_t flags = MOVE_FLAGS(mv);
+
+    //Everything that isn't derived from the move itself
+    undo->key = board->key;
+    undo->state = board->state;
+    undo->code = PIECE_AT(board, from);
+    undo->captured = (flags & MOVE_CAPTURE) ? PIECE_AT(board, to)
+            : SQUARE_EMPTY;
+
+    assert(undo->code != SQUARE_EMPTY);
+
+    if (flags & MOVE_PROMOTION)
+    {
+        moveSpecialSide(from, to, white, board, board,
+                promotion_codes[flags & PROMOTE_MASK] + ((white) ? 0 : B_P));
+    }
+    else if (flags & MOVE_CASTLE)
+    {
+        moveSpecialSide(from, to, white, board, board, 0);
+    }
+    else
+    {
+        makeMoveSide(from, to, white, board, board);
+    }
+}
+
+/*
+ * Makes a packed move on a board in place, recording what's needed to take
+ *  it back with undoMove()
+ *
+ * @uses promotion_codes
+ *
+ * @param board The board to make the move on
+ * @param mv The move to make, from generateMoves()
+ * @param white true if the move is white's
+ * @param undo Filled with the state needed to undo the move
+ */
+void doMove(chessboard * board, chessmove mv, bool white, undoinfo * undo)
+{
+    if (white)
+    {
+        doMoveSide(board, mv, true, undo);
+    }
+    else
+    {
+        doMoveSide(board, mv, false, undo);
+    }
+}
+
+/*
+ * undoMove() for a side fixed at compile time, see SIDE_INLINE
+ */
+SIDE_INLINE
+void undoMoveSide(chessboard * board, chessmove mv, const bool white,
+        undoinfo * undo)
+{
+    uint8_t from = MOVE_FROM(mv);
+    uint8_t to = MOVE_TO(mv);
+    bitboard moved = location_boards[from] | location_boards[to];
+
+    //Set up data pointers
+    bitboard * self_all = (white) ? &board->all_w_pieces : &board->all_b_pieces;
+    bitboard * op_all = (white) ? &board->all_b_pieces : &board->all_w_pieces;
+
+    //Put the piece back, as it was before any promotion
+    board->pieces[PIECE_AT(board, to) % B_P] &= ~location_boards[to];
+    board->pieces[undo->code % B_P] |= location_boards[from];
+    *self_all ^= moved;
+    SET_PIECE_AT(board, to, SQUARE_EMPTY);
+    SET_PIECE_AT(board, from, undo->code);
+
+    //The promotion piece shares bits with the castle flag
+    if ((MOVE_FLAGS(mv) & (MOVE_PROMOTION | MOVE_CASTLE)) == MOVE_CASTLE)
+    {
+        //Put the rook back in its corner
+        uint8_t rk_from = ((to % 8) == 6) ? to + 1 : to - 2;
+        uint8_t rk_to = ((to % 8) == 6) ? to - 1 : to + 1;
+        moved = location_boards[rk_from] | location_boards[rk_to];
+        board->pieces[W_R] ^= moved;
+        *self_all ^= moved;
+        SET_PIECE_AT(board, rk_to, SQUARE_EMPTY);
+        SET_PIECE_AT(board, rk_from, (white) ? W_R : B_R);
+    }
+
+    if (undo->captured != SQUARE_EMPTY)
+    {
+        //Bring back the captured piece
+        board->pieces[undo->captured % B_P] |= location_boards[to];
+        *op_all |= location_boards[to];
+        SET_PIECE_AT(board, to, undo->captured);
+    }
 
-    return (states);
+    board->key = undo->key;
+    board->state = undo->state;
+}
+
+/*
+ * Takes back a move made with doMove()
+ *
+ * @param board The board the move was made on
+ * @param mv The move that was made
+ * @param white true if the move is white's
+ * @param undo The state recorded by doMove()
+ */
+void undoMove(chessboard * board, chessmove mv, bool white, undoinfo * undo)
+{
+    if (white)
+    {
+        undoMoveSide(board, mv, true, undo);
+    }
+    else
+    {
+        undoMoveSide(board, mv, false, undo);
+    }
 }
 
 /**
@@ -290,27 +811,28 @@ bool invalidMoveSimple(bitboard destination, bitboard self_pieces,
 }
 
 /*
- * Generates a new board state based on a piece move
- *
- * @param pindex The index of the piece to move
- * @param location The location to move to
- * @param white true If the piece being moved is white
- * @param current The chessboard state being referenced
- * @param new The new chessboard state to write to
+ * makeMove() for a side fixed at compile time, see SIDE_INLINE
  */
-bool makeMove(uint8_t pindex, uint8_t location, bool white,
+SIDE_INLINE
+bool makeMoveSide(uint8_t from, uint8_t location, const bool white,
         chessboard * const current, chessboard * new)
 {
     //Generate the new location bitboard for the new location
     bitboard new_loc = location_boards[location];
 
-    //copy data
-    memmove(new, current, sizeof(chessboard));
+    //copy data, unless the move is being made in place
+    if (new != current)
+    {
+        memcpy(new, current, sizeof(chessboard));
+    }
 
-    uint8_t * ident_moves = (white) ? &new->w_ident_moves : &new->b_ident_moves;
-    uint8_t * last_move = (white) ? &new->w_last_move : &new->b_last_move;
-    uint8_t * last_move2 = (white) ? &new->w_last_move2 : &new->b_last_move2;
-    uint8_t * last_piece = (white) ? &new->w_last_piece : &new->b_last_piece;
+    boardstate * state = &new->state;
+    uint8_t * ident_moves = (white) ? &state->w_ident_moves
+            : &state->b_ident_moves;
+    uint8_t * last_from = (white) ? &state->w_last_from : &state->b_last_from;
+    uint8_t * last_move = (white) ? &state->w_last_move : &state->b_last_move;
+    uint8_t * last_move2 = (white) ? &state->w_last_move2
+            : &state->b_last_move2;
 
     //Update last move
     //See if moved to the same location last or two turns ago
@@ -320,198 +842,154 @@ bool makeMove(uint8_t pindex, uint8_t location, bool white,
                     (*ident_moves) + 1 : 0;
     *last_move2 = *last_move;
     *last_move = location;
-    *last_piece = pindex;
+    *last_from = from;
 
     //Set up data pointers
     //All pieces
     bitboard * self_all = (white) ? &new->all_w_pieces : &new->all_b_pieces;
     bitboard * op_all = (white) ? &new->all_b_pieces : &new->all_w_pieces;
-    //location bitboards
-    bitboard * self_locs = (white) ? new->w_locations : new->b_locations;
-    bitboard * op_locs = (white) ? new->b_locations : new->w_locations;
-    //piece value
-    uint8_t * self_pcs = (white) ? new->w_piece_posns : new->b_piece_posns;
-    uint8_t * op_pcs = (white) ? new->b_piece_posns : new->w_piece_posns;
 
-    //Castling data
-    uint8_t * cancastle = (white) ? &new->w_cancastle : &new->b_cancastle;
+    uint8_t code = PIECE_AT(new, from);
+    uint8_t captured = PIECE_AT(new, location);
 
-    uint8_t * op_cancastle = (white) ? &new->b_cancastle : &new->w_cancastle;
+    //Castling rights before the move, for updating the key
+    uint8_t w_castle = state->w_cancastle;
+    uint8_t b_castle = state->b_cancastle;
 
-    //Update appropriately for castling
-    if (*cancastle)
-    {
-        if (pindex == 15 || pindex == 8 || pindex == 9)
-        {
-            //king or rook moved
-            switch (pindex)
-            {
-            case 15:
-                //king moved
-                *cancastle = 0;
-                break;
-            case 8:
-                //queenside rook moved
-                *cancastle &= KINGSIDE_ROOK;
-                break;
-            case 9:
-                //kingside rook moved
-                *cancastle &= QUEENSIDE_ROOK;
-                break;
-            }
-        }
+    bool capture = false;
 
-        if ((self_pcs[pindex] / 8) == 0)
-        {
-            //Moving out of row 1 opening spot for castling
-            //Turn on bit at location
-            new->w_castlefree |= (1 << (self_pcs[pindex] % 8));
-        }
-        else if ((self_pcs[pindex] / 8) == 7)
-        {
-            //Moving out of row 8 opening spot for castling
-            //Turn on bit at location
-            new->b_castlefree |= (1 << (self_pcs[pindex] % 8));
-        }
-
-        if ((location / 8) == 0)
-        {
-            //Moving into row 1 closing spot for castling
-            //Turn off bit at location
-            new->w_castlefree &= ~(1 << (location % 8));
-        }
-        else if ((location / 8) == 7)
-        {
-            //Moving into row 8 closing spot for castling
-            //Turn off bit at location
-            new->b_castlefree &= ~(1 << (location % 8));
-        }
-    }
-
-    //Update the occupancy bitboard
-    //XOR out the old location, XOR in the new location
-    *self_all ^= (self_locs[pindex] ^ new_loc);
-    //Update position bitboard
-    self_locs[pindex] = new_loc;
-    //update piece location
-    self_pcs[pindex] = location;
+    //Moving a king or rook off its square, or capturing a rook on its
+    //  square, loses the castling that needs it
+    state->w_cancastle &= w_castle_masks[from] & w_castle_masks[location];
+    state->b_cancastle &= b_castle_masks[from] & b_castle_masks[location];
 
     //Handle captures, capturing if opponent piece @ location
-    //  (maybe should be in own function?)
     if ((*op_all) & new_loc)
     {
-        for (uint8_t i = 0; i < 16; ++i)
-        {
-            //If opponent piece at same location as new location
-            if (op_locs[i] == new_loc)
-            {
-                //XOR out location in occupancy board
-                *op_all ^= op_locs[i];
-                //Set to invalid position
-                op_locs[i] = 0;
-                //Flag as captured
-                op_pcs[i] = CAPTURED;
-
-                //See if ability for opponent to castle has changed
-                if (*op_cancastle && (i == 15 || i == 8 || i == 9))
-                {
-                    //king or rook moved
-                    switch (pindex)
-                    {
-                    case 15:
-                        //king moved
-                        *op_cancastle = 0;
-                        break;
-                    case 8:
-                        //queenside rook capped
-                        *op_cancastle &= KINGSIDE_ROOK;
-                        break;
-                    case 9:
-                        //kingside rook capped
-                        *op_cancastle &= QUEENSIDE_ROOK;
-                        break;
-                    }
-                }
-                //done
-                break;
-            }
-        }
+        //XOR out location in the piece & occupancy boards
+        new->pieces[captured % B_P] ^= new_loc;
+        *op_all ^= new_loc;
+        //XOR out the captured piece from the key
+        new->key ^= key_table[captured][location];
 
-        return (true);
+        capture = true;
     }
 
-    return (false);
+    //Update the key, XOR out the old location, XOR in the new location
+    new->key ^= key_table[code][from] ^ key_table[code][location];
+
+    //Update the piece & occupancy bitboards
+    //XOR out the old location, XOR in the new location
+    new->pieces[code % B_P] ^= location_boards[from] ^ new_loc;
+    *self_all ^= location_boards[from] ^ new_loc;
+    //Update the mailbox
+    SET_PIECE_AT(new, from, SQUARE_EMPTY);
+    SET_PIECE_AT(new, location, code);
+
+    //Move the piece's value, and take off what was captured. An empty
+    //  square's values are all 0
+    state->phase = (uint8_t) (state->phase - phase_vals[captured]);
+    for (uint8_t i = 0; i < 2; ++i)
+    {
+        state->value[i] = (int16_t) (state->value[i]
+                + piece_square_vals[i][code][location]
+                - piece_square_vals[i][code][from]
+                - piece_square_vals[i][captured][location]);
+    }
+
+    //Swap the castling rights in the key if they changed
+    new->key ^= castle_keys[0][w_castle]
+            ^ castle_keys[0][state->w_cancastle]
+            ^ castle_keys[1][b_castle] ^ castle_keys[1][state->b_cancastle];
+
+    return (capture);
 }
 
 /*
- * Handles making special moves such as castling/en passant/promotion
- *
- * !!This function should ONLY BE CALLED if a special move has been made,
- *   it is only responsible for handling board state updating, NOT validating
- *   if a move is special or not!!
+ * Generates a new board state based on a piece move
  *
- * @uses *_initial to determine index of rook for castling maneuver
+ * @uses w_castle_masks, b_castle_masks, key_table, castle_keys,
+ *       piece_square_vals, phase_vals
  *
- * @param pindex The index of the piece to move
+ * @param from The location of the piece to move
  * @param location The location to move to
  * @param white true If the piece being moved is white
  * @param current The chessboard state being referenced
- * @param new The new chessboard state to write to
- * @param promote_to If promoting, this is the piece code of the desired
- *                   promotion
+ * @param new The new chessboard state to write to, may be current to make
+ *            the move in place
  */
-void moveSpecial(uint8_t pindex, uint8_t location, bool white,
+bool makeMove(uint8_t from, uint8_t location, bool white,
+        chessboard * const current, chessboard * new)
+{
+    return ((white) ? makeMoveSide(from, location, true, current, new)
+            : makeMoveSide(from, location, false, current, new));
+}
+
+/*
+ * moveSpecial() for a side fixed at compile time, see SIDE_INLINE
+ */
+SIDE_INLINE
+void moveSpecialSide(uint8_t from, uint8_t location, const bool white,
         chessboard * const current, chessboard * new, uint8_t promote_to)
 {
 
-    //Now that new is set up right
     //If it's a pawn, then it's a promotion or en passant
-    if ((white && current->w_codes[pindex] == W_P)
-            || (!white && current->b_codes[pindex] == B_P))
+    if (PIECE_AT(current, from) % B_P == W_P)
     {
         //do initial work with makeMove
         //Capturing during a pawn promotion move will be handled by this
-        makeMove(pindex, location, white, current, new);
+        makeMoveSide(from, location, white, current, new);
 
         //If in row 1 or row 8, then promoting pawn
         if ((location / 8) == 7 || (location / 8) == 0)
         {
-            //piece code pointers
-            uint8_t * p_codes = (white) ? new->w_codes : new->b_codes;
-
-            //Update piece code
-            p_codes[pindex] = promote_to;
+            //Swap the pawn for the promoted piece in the key
+            new->key ^= key_table[(white) ? W_P : B_P][location]
+                    ^ key_table[promote_to][location];
+
+            //Swap the pawn for the promoted piece on the boards
+            new->pieces[W_P] ^= location_boards[location];
+            new->pieces[promote_to % B_P] ^= location_boards[location];
+            SET_PIECE_AT(new, location, promote_to);
+
+            //And in the value, a pawn doesn't count towards the phase
+            new->state.phase = (uint8_t) (new->state.phase
+                    + phase_vals[promote_to]);
+            for (uint8_t i = 0; i < 2; ++i)
+            {
+                new->state.value[i] = (int16_t) (new->state.value[i]
+                        + piece_square_vals[i][promote_to][location]
+                        - piece_square_vals[i][(white) ? W_P : B_P][location]);
+            }
         }
         else
         {
             //opponent data pointers
             bitboard * op_all =
                     (white) ? &new->all_b_pieces : &new->all_w_pieces;
-            //location bitboards
-            bitboard * op_locs = (white) ? new->b_locations : new->w_locations;
-            //piece value
-            uint8_t * op_pcs = (white) ? new->b_piece_posns : new->w_piece_posns;
 
             //It's an en passant capture, so the pawn must be +- 1 row from
             //  location. It's -1 row if white, +1 row if black
-            int8_t delta = (white) ? -8 : 8;
-            //Get location of pawn being captured
-            bitboard cap_loc = location_boards[location + delta];
+            uint8_t captured = (uint8_t) ((white) ? location - 8
+                    : location + 8);
 
-            for (uint8_t i = 0; i < 16; ++i)
+            //If opponent piece at capture location
+            if (*op_all & location_boards[captured])
             {
-                //If opponent piece at capture location
-                if (op_locs[i] == cap_loc)
+                for (uint8_t i = 0; i < 2; ++i)
                 {
-                    //XOR out location in occupancy board
-                    *op_all ^= op_locs[i];
-                    //Set to invalid position
-                    op_locs[i] = 0;
-                    //Flag as captured
-                    op_pcs[i] = CAPTURED;
-                    //done
-                    break;
+                    new->state.value[i] = (int16_t) (new->state.value[i]
+                            - piece_square_vals[i][PIECE_AT(new, captured)]
+                                    [captured]);
                 }
+
+                //XOR out the captured pawn from the key
+                new->key ^= key_table[PIECE_AT(new, captured)][captured];
+                //XOR out location in the piece & occupancy boards
+                new->pieces[PIECE_AT(new, captured) % B_P] ^=
+                        location_boards[captured];
+                *op_all ^= location_boards[captured];
+                SET_PIECE_AT(new, captured, SQUARE_EMPTY);
             }
         }
     }
@@ -519,89 +997,199 @@ void moveSpecial(uint8_t pindex, uint8_t location, bool white,
     {
         //Piece coming in will be a king (otherwise we won't know it's
         //  a castling maneuver per the project spec
-        //King is in place because of makeMove, so need to determine rook to
-        //  move and put it in place
+        //Need to determine rook to move and put it in place
         uint8_t rk;
         uint8_t rk_to;
         //Check for queenside vs kingside rook
         if ((location % 8) == 6)
         {
-            //kingside rook, index is 09 of array
-            rk = 9;
+            //kingside rook, on h1 (white) or h8 (black)
+            rk = location + 1;
             //it goes to f1 (white) or f8 (black)
             //  These are -1 column back from king position (passed in)
             rk_to = location - 1;
         }
         else
         {
-            //queenside rook, index is 08 of array
-            rk = 8;
+            //queenside rook, on a1 (white) or a8 (black)
+            rk = location - 2;
             //it goes to d1 (white) or d8 (black)
             //  These are +1 column back from king position (passed in)
             rk_to = location + 1;
         }
         //Use makeMove to put rook into right location & copy to new
-        makeMove(rk, rk_to, white, current, new);
+        makeMoveSide(rk, rk_to, white, current, new);
         //Move King into right location and update new
-        makeMove(pindex, location, white, new, new);
+        makeMoveSide(from, location, white, new, new);
     }
 }
 
 /*
- * Evaluates the value of a particular board
+ * Handles making special moves such as castling/en passant/promotion
  *
- * Based on:
- *   http://chessprogramming.wikispaces.com/Simplified+evaluation+function
+ * !!This function should ONLY BE CALLED if a special move has been made,
+ *   it is only responsible for handling board state updating, NOT validating
+ *   if a move is special or not!!
  *
- * @uses all of the *_*_positions globals, modifier, piece_vals, *_codes
+ * @uses key_table, piece_square_vals, phase_vals
  *
- * @param board The board to evaluate
- * @return The value of the board in a form usable in a negamax function
+ * @param from The location of the piece to move
+ * @param location The location to move to
+ * @param white true If the piece being moved is white
+ * @param current The chessboard state being referenced
+ * @param new The new chessboard state to write to
+ * @param promote_to If promoting, this is the piece code of the desired
+ *                   promotion
  */
-int evaluateState(chessboard * const board, bool white)
+void moveSpecial(uint8_t from, uint8_t location, bool white,
+        chessboard * const current, chessboard * new, uint8_t promote_to)
 {
-    //TODO Maybe this can be more complex? expansion is pretty fast
-    int value = 0;
-    int w_val = 0;
-    int b_val = 0;
+    if (white)
+    {
+        moveSpecialSide(from, location, true, current, new, promote_to);
+    }
+    else
+    {
+        moveSpecialSide(from, location, false, current, new, promote_to);
+    }
+}
 
-    if (board->w_piece_posns[15] != CAPTURED && board->b_piece_posns[15] != CAPTURED
-            && (board->w_ident_moves >= 3 || board->b_ident_moves >= 3))
+/*
+ * Computes the Zobrist key of a board from scratch. makeMove() and
+ * moveSpecial() keep the key up to date incrementally, so this only needs to
+ * be called when a board is set up.
+ *
+ * @uses key_table, castle_keys
+ *
+ * @param board The board to hash
+ * @return The key for the board, not including the side to move
+ */
+hashkey hashBoard(chessboard * const board)
+{
+    hashkey key = castle_keys[0][board->state.w_cancastle]
+            ^ castle_keys[1][board->state.b_cancastle];
+    bitboard occupied = board->all_w_pieces | board->all_b_pieces;
+    uint8_t pos;
+
+    while (occupied)
     {
-        return (0);
+        pos = (uint8_t) __builtin_ctzll(occupied);
+        occupied &= occupied - 1;
+        key ^= key_table[PIECE_AT(board, pos)][pos];
     }
 
-    //Check for endgame state
-    if (board->w_piece_posns[14] == CAPTURED && board->b_piece_posns[14] == CAPTURED)
+    return (key);
+}
+
+/*
+ * Sums the material and position value of every piece on a board. With
+ *  AVX2 the mailbox is spread out eight squares at a time and the values
+ *  gathered straight from the table, otherwise each piece is looked up in
+ *  turn.
+ *
+ * @uses piece_square_vals
+ *
+ * @param board The board to score
+ * @param endgame true to use the endgame tables
+ * @return White's total less black's
+ */
+int sumPieceSquares(chessboard * const board, bool endgame)
+{
+    int32_t (*values)[64] = piece_square_vals[endgame];
+#ifdef __AVX2__
+    //The nibble of each lane within 4 bytes of the mailbox
+    const __m256i shifts = _mm256_setr_epi32(0, 4, 8, 12, 16, 20, 24, 28);
+    const __m256i nibble = _mm256_set1_epi32(0xF);
+    __m256i squares = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    __m256i sum = _mm256_setzero_si256();
+    __m256i codes;
+    __m128i half;
+    uint32_t packed;
+
+    for (uint8_t i = 0; i < 32; i += 4)
     {
-        board_position_vals[11] = b_K_e_positions;
+        //Eight squares of codes, one to a lane, then the table index of
+        //  each piece on its square. Empty squares index a row of 0s
+        memcpy(&packed, &board->squares[i], sizeof(packed));
+        codes = _mm256_and_si256(_mm256_srlv_epi32(
+                _mm256_set1_epi32((int) packed), shifts), nibble);
+        codes = _mm256_add_epi32(_mm256_slli_epi32(codes, 6), squares);
+        sum = _mm256_add_epi32(sum,
+                _mm256_i32gather_epi32(&values[0][0], codes, 4));
+        squares = _mm256_add_epi32(squares, _mm256_set1_epi32(8));
     }
-    else
+
+    //Add the lanes together
+    half = _mm_add_epi32(_mm256_castsi256_si128(sum),
+            _mm256_extracti128_si256(sum, 1));
+    half = _mm_add_epi32(half, _mm_shuffle_epi32(half, 0x4E));
+    half = _mm_add_epi32(half, _mm_shuffle_epi32(half, 0xB1));
+
+    return (_mm_cvtsi128_si32(half));
+#else
+    bitboard occupied = board->all_w_pieces | board->all_b_pieces;
+    int value = 0;
+    uint8_t pos;
+
+    while (occupied)
     {
-        board_position_vals[11] = b_K_m_positions;
+        pos = (uint8_t) __builtin_ctzll(occupied);
+        occupied &= occupied - 1;
+        value += values[PIECE_AT(board, pos)][pos];
     }
 
-    //Sum up the values for white and black
-    for (uint8_t i = 0; i < 16; ++i)
+    return (value);
+#endif
+}
+
+/*
+ * Works out the game phase of a board from its pieces
+ *
+ * @param board The board to look at
+ * @return The sum of the phase_vals of the pieces on the board
+ */
+uint8_t gamePhase(chessboard * const board)
+{
+    return ((uint8_t) (__builtin_popcountll(board->pieces[W_N]
+            | board->pieces[W_B])
+            + 2 * __builtin_popcountll(board->pieces[W_R])
+            + 4 * __builtin_popcountll(board->pieces[W_Q])));
+}
+
+/*
+ * Evaluates the value of a particular board
+ *
+ * Based on:
+ *   http://chessprogramming.wikispaces.com/Simplified+evaluation+function
+ *
+ * The middlegame and endgame totals are blended by how many pieces are left,
+ *  so the kings move over to their endgame tables gradually as pieces are
+ *  traded rather than all at once. Nothing global is written, so threads
+ *  can evaluate at the same time.
+ *
+ * @param board The board to evaluate
+ * @return The value of the board in a form usable in a negamax function
+ */
+int evaluateState(chessboard * const board, bool white)
+{
+    //TODO Maybe this can be more complex? expansion is pretty fast
+    int value;
+    //Promotions can take the phase past the start
+    int phase = (board->state.phase < PHASE_MAX) ? board->state.phase
+            : PHASE_MAX;
+
+    assert(board->state.value[0] == sumPieceSquares(board, false));
+    assert(board->state.value[1] == sumPieceSquares(board, true));
+    assert(board->state.phase == gamePhase(board));
+
+    if (board->state.w_ident_moves >= 3 || board->state.b_ident_moves >= 3)
     {
-        //Get each piece's value, and add in the value of its position
-        //If it's captured, then add 0
-        //White
-        w_val +=
-                (board->w_piece_posns[i] == CAPTURED) ?
-                        0 :
-                        piece_vals[board->w_codes[i]]
-                                + board_position_vals[board->w_codes[i]][board->w_piece_posns[i]];
-        //Same for Black
-        b_val +=
-                (board->b_piece_posns[i] == CAPTURED) ?
-                        0 :
-                        piece_vals[board->b_codes[i]]
-                                + board_position_vals[board->b_codes[i]][board->b_piece_posns[i]];
+        return (0);
     }
 
     //Value = white - black
-    value = w_val - b_val;
+    value = (board->state.value[0] * phase
+            + board->state.value[1] * (PHASE_MAX - phase)) / PHASE_MAX;
 
     //If we are white, then we want max white, and this is already going to
     //  have higher scores for better values for white
@@ -619,8 +1207,7 @@ int evaluateState(chessboard * const board, bool white)
  */
 void printBoard(chessboard * const board)
 {
-    //Yeah this is slow and bad
-    uint8_t col, row, pindex;
+    uint8_t col, row, entry;
 
     puts("\ncol a|b|c|d|e|f|g|h\n                      row");
     printf("    ");
@@ -631,25 +1218,21 @@ void printBoard(chessboard * const board)
         row = (uint8_t) i / 8;
         col = i % 8;
         //Piece glyphs
-        pindex = findPieceByPosition((uint8_t) i, board->w_piece_posns);
+        entry = PIECE_AT(board, i);
 
-        if(pindex == 16)
+        if(entry == SQUARE_EMPTY)
         {
-            //No white pieces at location
-            pindex = findPieceByPosition((uint8_t) i, board->b_piece_posns);
-            if(pindex != 16)
-            {
-                printf("%c", piece_chars[board->b_codes[pindex]] + 'a' - 'A');
-            }
-            else
-            {
-                //No black pieces at location
-                putchar((col % 2) ^ (row % 2) ? '~' : ' ');
-            }
+            //No pieces at location
+            putchar((col % 2) ^ (row % 2) ? '~' : ' ');
+        }
+        else if(entry >= B_P)
+        {
+            //Lower case for black
+            printf("%c", piece_chars[entry] + 'a' - 'A');
         }
         else
         {
-            printf("%c", piece_chars[board->w_codes[pindex]]);
+            printf("%c", piece_chars[entry]);
         }
 
         //End of row
@@ -680,14 +1263,14 @@ void printBoard(chessboard * const board)
 void getMoveString(chessboard * const board, chessboard * const prev,
 bool white, char out[6])
 {
-    //The piece that moved
-    uint8_t piece = (white) ? board->w_last_piece : board->b_last_piece;
     //The location it was in
-    uint8_t last_loc = (white) ? prev->w_piece_posns[piece] : prev->b_piece_posns[piece];
+    uint8_t last_loc = (white) ? board->state.w_last_from
+            : board->state.b_last_from;
     //The location it moved to
-    uint8_t last_mv = (white) ? board->w_last_move : board->b_last_move;
+    uint8_t last_mv = (white) ? board->state.w_last_move
+            : board->state.b_last_move;
     //The piece ID
-    uint8_t pid = (white) ? prev->w_codes[piece] : prev->b_codes[piece];
+    uint8_t pid = PIECE_AT(prev, last_loc);
 
     //then the square from, into 0,1 (2 will be \0)
     squareToString(last_loc, &out[0]);
@@ -697,7 +1280,7 @@ bool white, char out[6])
     if (pid == W_P || pid == B_P)
     {
         //Check for pawn promotion
-        uint8_t npid = (white) ? board->w_codes[piece] : prev->b_codes[piece];
+        uint8_t npid = PIECE_AT(board, last_mv);
         //Record promotion (if applicable)
         out[4] = (npid != pid) ? piece_chars[npid] : out[4];
     }
@@ -740,15 +1323,11 @@ void parseMoveString(char move[6], bool white, chessboard * board)
     //shhhhhh
     square_end += (col_end - 'a');
 
-    //Find the array index
-    uint8_t * pieces = (white) ? board->w_piece_posns : board->b_piece_posns;
-    uint8_t pindex;
+    //The piece moving
+    uint8_t code = PIECE_AT(board, square_start);
 
     bitboard op_oc = (white) ? board->all_b_pieces : board->all_w_pieces;
 
-    //Find matching location
-    pindex = findPieceByPosition(square_start, pieces);
-
     //See if it's a promotion
     if (promote != '\0')
     {
@@ -763,29 +1342,29 @@ void parseMoveString(char move[6], bool white, chessboard * board)
         }
 
         //Do the promotion
-        moveSpecial(pindex, square_end, white, board, board, promote_to);
+        moveSpecial(square_start, square_end, white, board, board, promote_to);
     }
     //Pawn move, check for en passant
     //  If moving diagonally, and not a piece @ location
-    else if ((piece_chars[pieces[pindex]] == 'P') && (col_start != col_end)
+    else if ((piece_chars[code] == 'P') && (col_start != col_end)
             && !(location_boards[square_end] & op_oc))
     {
-        moveSpecial(pindex, square_end, white, board, board, 0);
+        moveSpecial(square_start, square_end, white, board, board, 0);
     }
     //King move
     //Starting in start column
     //Staying in same row
     //moving more than one column
     //Must be a castling maneuver
-    else if (piece_chars[pieces[pindex]] == 'K' && (col_start == 'e')
+    else if (piece_chars[code] == 'K' && (col_start == 'e')
             && (col_end != 'd' && col_end != 'f') && (row_start == row_end))
     {
-        moveSpecial(pindex, square_end, white, board, board, 0);
+        moveSpecial(square_start, square_end, white, board, board, 0);
     }
     //Normal move
     else
     {
-        makeMove(pindex, square_end, white, board, board);
+        makeMove(square_start, square_end, white, board, board);
     }
 
 #ifndef NDEBUG
@@ -813,29 +1392,6 @@ void squareToString(uint8_t pos, char str[3])
     str[1] = rows[pos / 8];
 }
 
-/*
- * Finds if the index of the piece at a location
- *
- * @param pos The position (0-64) of the piece
- * @param positions The array of positions to search for
- *
- * @return The index of the piece at the supplied position, 16 if not found
- */
-uint8_t findPieceByPosition(uint8_t pos, uint8_t positions[16])
-{
-    uint8_t pindex;
-    for (pindex = 0; pindex < 16; ++pindex)
-    {
-        if (positions[pindex] == pos)
-        {
-            break;
-        }
-    }
-
-    return pindex;
-}
-
-
 /*
  * for readability/debugging purposes, should not be used for net moves
  *
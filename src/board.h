@@ -17,6 +17,9 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdbool.h>
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
 
 #include "common_defs.h"
 #include "globals.h"
@@ -61,61 +64,141 @@
 //Destination for queenside white castle is c1
 #define QUEENSIDE_W_CASTLE 2
 
+//Edge files, to mask off pieces that wrapped around the board when shifted
+#define FILE_A ((bitboard) 0x0101010101010101)
+#define FILE_H ((bitboard) 0x8080808080808080)
+
+//Squares attacked by a slider on a square, given the occupied squares
+#define ROOK_ATTACKS(sq, occupied) \
+    (rook_attacks[(sq)][(((occupied) & rook_masks[(sq)]) \
+            * rook_magics[(sq)]) >> (64 - ROOK_INDEX_BITS)])
+#define BISHOP_ATTACKS(sq, occupied) \
+    (bishop_attacks[(sq)][(((occupied) & bishop_masks[(sq)]) \
+            * bishop_magics[(sq)]) >> (64 - BISHOP_INDEX_BITS)])
+
+//Move packing, 6 bits for the source square and 6 for the destination, with
+//  4 bits of flags on top
+#define MOVE(from, to) ((chessmove) (((from) << 6) | (to)))
+#define MOVE_FLAGGED(from, to, flags) \
+    ((chessmove) (((flags) << 12) | ((from) << 6) | (to)))
+#define MOVE_FROM(mv) ((uint8_t) (((mv) >> 6) & 0x3F))
+#define MOVE_TO(mv) ((uint8_t) ((mv) & 0x3F))
+#define MOVE_FLAGS(mv) ((uint8_t) ((mv) >> 12))
+//Just the squares of a move, to compare against MOVE()
+#define MOVE_SQUARES(mv) ((chessmove) ((mv) & 0xFFF))
+//a1a1 can never be made, so it's used to mean no move
+#define NO_MOVE ((chessmove) 0)
+
+//Move flags
+//An opponent piece is on the destination
+#define MOVE_CAPTURE 0x4
+//The move is a promotion, the low 2 bits are the PROMOTE_* piece
+#define MOVE_PROMOTION 0x8
+//The move is a castle, the king's squares are given. Only without
+//  MOVE_PROMOTION, where this bit is part of the promotion piece
+#define MOVE_CASTLE 0x2
+
+//Promotion pieces, see promotion_codes
+#define PROMOTE_N 0
+#define PROMOTE_B 1
+#define PROMOTE_R 2
+#define PROMOTE_Q 3
+#define PROMOTE_MASK 0x3
+
+//Game phase with every piece but the pawns on the board, see phase_vals
+#define PHASE_MAX 24
+
+//Most moves any legal position has
+#define MAX_MOVES 218
+//Most moves a single piece can have, a queen in the middle of the board
+#define MAX_PIECE_MOVES 27
+
+//Kinds of move for generateMoves(), captures includes promotions
+#define GEN_CAPTURES 0x1
+#define GEN_QUIETS 0x2
+#define GEN_ALL (GEN_CAPTURES | GEN_QUIETS)
+
+//Mailbox entries, the code of the piece on each square, two squares to a
+//  byte with the lower square in the low nibble
+#define SQUARE_EMPTY ((uint8_t) 0xF)
+#define PIECE_AT(board, sq) \
+    ((uint8_t) (((board)->squares[(sq) >> 1] >> (((sq) & 1) << 2)) & 0xF))
+#define SET_PIECE_AT(board, sq, code) \
+    ((board)->squares[(sq) >> 1] = (uint8_t) (((board)->squares[(sq) >> 1] \
+            & (0xF0 >> (((sq) & 1) << 2))) | ((code) << (((sq) & 1) << 2))))
+
+//Bitboard of one side's pieces of a kind, by piece code
+#define PIECES(board, code) \
+    ((board)->pieces[(code) % B_P] & (((code) < B_P) ? \
+            (board)->all_w_pieces : (board)->all_b_pieces))
+
+/*
+ * A move packed into 16 bits, see MOVE()
+ */
+typedef uint16_t chessmove;
+
+/*
+ * Everything about a position other than where the pieces are, and the
+ *  running totals worked out from them. doMove() saves it whole for
+ *  undoMove() to put back.
+ */
+typedef struct
+{
+    //0 means cannot, KINGSIDE_ROOK and/or QUEENSIDE_ROOK while the king and
+    //  that rook haven't moved
+    uint8_t w_cancastle;
+    uint8_t b_cancastle;
+    //Where the last move came from
+    uint8_t w_last_from;
+    uint8_t b_last_from;
+    //Last location moved to
+    uint8_t w_last_move;
+    uint8_t b_last_move;
+    //Two moves ago
+    uint8_t w_last_move2;
+    uint8_t b_last_move2;
+    //how many times in a row the same move was made
+    uint8_t w_ident_moves;
+    uint8_t b_ident_moves;
+    //Sum of the phase_vals of the pieces, PHASE_MAX down to 0 as pieces are
+    //  traded off, or more after promotions
+    uint8_t phase;
+    //White's material & position less black's, [middlegame/endgame], kept
+    //  up to date as pieces move so it needn't be summed at every leaf
+    int16_t value[2];
+} boardstate;
+
 /*
  * Defines an overall board state for the program
  *
  * Positions are coded from the white side of the board starting at a1 (0) up
  * to h8 (63).
  *
- * A value of 64 indicates a captured piece
+ * The pieces are kept as one bitboard per kind, shared by both sides, with
+ *  each side's occupancy to tell them apart, see PIECES(). With the packed
+ *  mailbox and the state that's 120 bytes, so copying a board or missing it
+ *  in the cache touches at most two cache lines.
  *
  */
 #pragma clang diagnostic push
 #pragma clang diagnostic ignored "-Wpadded"
 typedef struct
 {
-    //Locations of all white pieces
-    uint8_t w_piece_posns[16];
+    //Bitboards of each kind of piece, indexed by the white piece code
+    bitboard pieces[6];
     //Bitboard of all white pieces
     bitboard all_w_pieces;
-    //Bitboards of individual piece locations for white
-    bitboard w_locations[16];
-    //White Piece IDS
-    uint8_t w_codes[16];
-    //0 means cannot, 1 means queenside rook moved, 3 means kingside rook moved
-    uint8_t w_cancastle;
-    //0 means no squares free, 0x70 means queenside free,
-    //  0x03 means kingside free, 0x73 means both free,
-    uint8_t w_castlefree;
-
-    //Locations of all black pieces
-    uint8_t b_piece_posns[16];
     //Bitboard of all black pieces
     bitboard all_b_pieces;
-    //Bitboards of individual piece locations for black
-    bitboard b_locations[16];
-    //White Piece IDS
-    uint8_t b_codes[16];
-    //0 means cannot, 1 means queenside rook moved, 2 means kingside rook moved
-    //  3 means neither moved
-    uint8_t b_cancastle;
-    //0 means no squares free, 0x70 means queenside free,
-    //  0x03 means kingside free, 0x73 means both free,
-    uint8_t b_castlefree;
-
-    //Tracking data
-    //Last piece moved (as index of array)
-    uint8_t w_last_piece;
-    uint8_t b_last_piece;
-    //Last location moved to
-    uint8_t w_last_move;
-    uint8_t b_last_move;
-    //Two moves ago
-    uint8_t w_last_move2;
-    uint8_t b_last_move2;
-    //how many times in a row the same move was made
-    uint8_t w_ident_moves;
-    uint8_t b_ident_moves;
+
+    //Zobrist key of the position, not including the side to move
+    hashkey key;
+
+    //What's on each square, see PIECE_AT()
+    uint8_t squares[32];
+
+    //Castling & tracking data
+    boardstate state;
 
 } chessboard;
 
@@ -124,30 +207,218 @@ typedef struct
     uint8_t count;
     chessboard * data;
 } boardset;
+
+/*
+ * What doMove() changed that can't be worked out from the move, so that
+ *  undoMove() can put it back
+ */
+typedef struct
+{
+    //Key before the move
+    hashkey key;
+    //State before the move
+    boardstate state;
+    //Code of the piece moved before any promotion
+    uint8_t code;
+    //Code of the piece captured, SQUARE_EMPTY if none
+    uint8_t captured;
+} undoinfo;
+
+/*
+ * What limits the moves of the side to move, see findChecks()
+ */
+typedef struct
+{
+    //Opponent pieces giving check
+    bitboard checkers;
+    //Squares pieces other than the king may move to, all of them when not in
+    //  check, and none in double check
+    bitboard evasions;
+    //Our pieces pinned against our king, which can only move along the line
+    //  through the king
+    bitboard pinned;
+    //Where our king is
+    uint8_t king;
+} checkinfo;
 #pragma clang diagnostic pop
 
 /*
  * Initializes the board to its base state, where no moves have been made yet
  *
- * @uses white_initial, black_initial, w_codes, b_codes
+ * @uses white_initial, black_initial, w_codes, b_codes, piece_square_vals
  *
  * @param board The chessboard to initialize.
  */
 void initBoard(chessboard * board);
 
+/*
+ * Finds the pieces of a side that attack a square
+ *
+ * @uses attacked_squares, rook_attacks, bishop_attacks
+ *
+ * @param board The board to look at
+ * @param sq The square attacked
+ * @param white true if looking for white's attackers
+ * @param occupied The squares that block sliders, usually every piece
+ * @return A bitboard of the locations of the attacking pieces
+ */
+bitboard attackersOf(chessboard * const board, uint8_t sq, bool white,
+        bitboard occupied);
+
+/*
+ * Finds the squares strictly between two squares on a rank, file or diagonal
+ *
+ * @uses attacked_squares, rook_attacks, bishop_attacks
+ *
+ * @param a One end of the line
+ * @param b The other end of the line
+ * @return The squares between a and b, 0 if they don't share a line
+ */
+bitboard squaresBetween(uint8_t a, uint8_t b);
+
+/*
+ * Finds the whole rank, file or diagonal through two squares
+ *
+ * @uses attacked_squares
+ *
+ * @param a A square on the line
+ * @param b Another square on the line
+ * @return The squares of the line, 0 if a and b don't share one
+ */
+bitboard squaresInLine(uint8_t a, uint8_t b);
+
+/*
+ * Works out the checks and pins that limit a side's moves
+ *
+ * @uses attacked_squares, rook_attacks, bishop_attacks
+ *
+ * @param board The board to look at
+ * @param white true if finding the checks against white
+ * @param checks Filled with the checkers, evasions and pins
+ */
+void findChecks(chessboard * const board, bool white, checkinfo * checks);
+
+/*
+ * Checks if a side's king is attacked
+ *
+ * @uses attacked_squares, rook_attacks, bishop_attacks
+ *
+ * @param board The board to look at
+ * @param white true if checking white's king
+ * @return true if the king is in check
+ */
+bool inCheck(chessboard * const board, bool white);
+
+/*
+ * Checks if a side has any legal move, if not it's checkmated when in check
+ *  and stalemated otherwise
+ *
+ * @uses location_boards, legal_moves, rook_attacks, bishop_attacks
+ *
+ * @param board The board to look at
+ * @param white true if checking white's moves
+ * @return true if the side can move
+ */
+bool hasLegalMoves(chessboard * const board, bool white);
+
+/*
+ * Generates the legal packed moves that can be made from a board
+ *
+ * @uses location_boards, legal_moves, rook_attacks, bishop_attacks
+ *
+ * @param board A pointer to the board to generate moves for
+ * @param white true if generating white's moves
+ * @param kinds Which moves to generate, GEN_CAPTURES and/or GEN_QUIETS
+ * @param checks The checks against the side, from findChecks()
+ * @param moves An array of at least MAX_MOVES moves to fill
+ * @return The number of moves generated
+ */
+uint8_t generateMoves(chessboard * const board, bool white, uint8_t kinds,
+        checkinfo * const checks, chessmove moves[]);
+
+/*
+ * Generates the packed moves that one piece can make, adding them after the
+ *  moves already generated
+ *
+ * @uses location_boards, legal_moves, rook_attacks, bishop_attacks
+ *
+ * @param board A pointer to the board to generate moves for
+ * @param white true if generating white's moves
+ * @param from The square of the piece, which must be one of the side's
+ * @param kinds Which moves to generate, GEN_CAPTURES and/or GEN_QUIETS
+ * @param checks The checks against the side, from findChecks()
+ * @param moves The array of moves to add to
+ * @param count The number of moves already in moves
+ * @return The number of moves in moves after the piece's are added
+ */
+uint8_t generatePieceMoves(chessboard * const board, bool white,
+        uint8_t from, uint8_t kinds, checkinfo * const checks,
+        chessmove moves[], uint8_t count);
+
+/*
+ * Checks that a move from somewhere else, like the transposition table or a
+ *  killer slot, can be made on a board. Only the moving piece's moves are
+ *  generated to check against.
+ *
+ * @param board The board to check the move against
+ * @param white true if the move would be white's
+ * @param checks The checks against the side, from findChecks()
+ * @param mv The move to check
+ * @return true if generateMoves() would generate mv for the board
+ */
+bool validMove(chessboard * const board, bool white,
+        checkinfo * const checks, chessmove mv);
+
 /*
  * Expands the set of all possible board states from an initial state
  *
  * @uses w_codes, b_codes, location_boards, legal_moves
  *
  * @param board A pointer to the board to expand
- * @param storage A pointer to an array in which to store the expanded states
- *         !!This pointer will be realloc'd to fit the set of expanded states!!
+ * @param storage The array to store the expanded states in, with room for
+ *                every move
  * @param white true if expanding the set of white moves
  * @return The number of states expanded
  */
 uint8_t expandStates(chessboard * const board, boardset * storage, bool white);
 
+/*
+ * Makes each of a list of moves on a copy of a board
+ *
+ * @param board A pointer to the board to make the moves from
+ * @param storage The array to store the new states in, with room for count
+ *                states
+ * @param white true if the moves are white's
+ * @param moves The moves to make
+ * @param count The number of moves
+ * @return The number of states made, count
+ */
+uint8_t expandMoves(chessboard * const board, boardset * storage, bool white,
+        chessmove moves[], uint8_t count);
+
+/*
+ * Makes a packed move on a board in place, recording what's needed to take
+ *  it back with undoMove()
+ *
+ * @uses promotion_codes
+ *
+ * @param board The board to make the move on
+ * @param mv The move to make, from generateMoves()
+ * @param white true if the move is white's
+ * @param undo Filled with the state needed to undo the move
+ */
+void doMove(chessboard * board, chessmove mv, bool white, undoinfo * undo);
+
+/*
+ * Takes back a move made with doMove()
+ *
+ * @param board The board the move was made on
+ * @param mv The move that was made
+ * @param white true if the move is white's
+ * @param undo The state recorded by doMove()
+ */
+void undoMove(chessboard * board, chessmove mv, bool white, undoinfo * undo);
+
 /**
  * Makes simple checks against a destination square to validate moves
  *
@@ -170,15 +441,19 @@ bool invalidMoveSimple(bitboard destination, bitboard self_pieces,
 /*
  * Generates a new board state based on a piece move
  *
- * @param pindex The index of the piece to move
+ * @uses w_castle_masks, b_castle_masks, key_table, castle_keys,
+ *       piece_square_vals, phase_vals
+ *
+ * @param from The location of the piece to move
  * @param location The location to move to
  * @param white true If the piece being moved is white
  * @param current The chessboard state being referenced
- * @param new The new chessboard state to write to
+ * @param new The new chessboard state to write to, may be current to make
+ *            the move in place
  *
  * @return true if a capture took place
  */
-bool makeMove(uint8_t pindex, uint8_t location, bool white,
+bool makeMove(uint8_t from, uint8_t location, bool white,
         chessboard * const current, chessboard * new);
 
 /*
@@ -188,7 +463,9 @@ bool makeMove(uint8_t pindex, uint8_t location, bool white,
  *   it is only responsible for handling board state updating, NOT validating
  *   if a move is special or not!!
  *
- * @param pindex The index of the piece to move
+ * @uses key_table, piece_square_vals, phase_vals
+ *
+ * @param from The location of the piece to move
  * @param location The location to move to
  * @param white true If the piece being moved is white
  * @param current The chessboard state being referenced
@@ -196,16 +473,53 @@ bool makeMove(uint8_t pindex, uint8_t location, bool white,
  * @param promote_to If promoting, this is the piece code of the desired
  *                   promotion
  */
-void moveSpecial(uint8_t pindex, uint8_t location, bool white,
+void moveSpecial(uint8_t from, uint8_t location, bool white,
         chessboard * const current, chessboard * new, uint8_t promote_to);
 
+/*
+ * Computes the Zobrist key of a board from scratch. makeMove() and
+ * moveSpecial() keep the key up to date incrementally, so this only needs to
+ * be called when a board is set up.
+ *
+ * @uses key_table, castle_keys
+ *
+ * @param board The board to hash
+ * @return The key for the board, not including the side to move
+ */
+hashkey hashBoard(chessboard * const board);
+
+/*
+ * Sums the material and position value of every piece on a board. With
+ *  AVX2 the mailbox is spread out eight squares at a time and the values
+ *  gathered straight from the table, otherwise each piece is looked up in
+ *  turn.
+ *
+ * @uses piece_square_vals
+ *
+ * @param board The board to score
+ * @param endgame true to use the endgame tables
+ * @return White's total less black's
+ */
+int sumPieceSquares(chessboard * const board, bool endgame);
+
+/*
+ * Works out the game phase of a board from its pieces
+ *
+ * @param board The board to look at
+ * @return The sum of the phase_vals of the pieces on the board
+ */
+uint8_t gamePhase(chessboard * const board);
+
 /*
  * Evaluates the value of a particular board
  *
  * Based on:
  *   http://chessprogramming.wikispaces.com/Simplified+evaluation+function
  *
- * @uses all of the *_*_positions globals
+ * The middlegame and endgame totals are blended by how many pieces are left,
+ *  so the kings move over to their endgame tables gradually as pieces are
+ *  traded rather than all at once. Nothing global is written, so threads
+ *  can evaluate at the same time.
  *
  * @param board The board to evaluate
  * @param white True if the call is being made from white's perspective
@@ -249,16 +563,6 @@ void parseMoveString(char move[6], bool white, chessboard * board);
  */
 void squareToString(uint8_t pos, char str[3]);
 
-/*
- * Finds if the index of the piece at a location
- *
- * @param pos The position (0-64) of the piece
- * @param positions The array of positions to search for
- *
- * @return The index of the piece at the supplied position, 16 if not found
- */
-uint8_t findPieceByPosition(uint8_t pos, uint8_t positions[16]);
-
 /*
  * for readability/debugging purposes, should not be used for net moves
  *
@@ -15,232 +15,1719 @@
 
 #include "brain.h"
 
+/*
+ * Options for the search, see searchoptions
+ *
+ * @users selectBestMove, negamax
+ * @modifiers main
+ */
+searchoptions search_options =
+{ 0, PARALLEL_LAZY_SMP, true, 2, true, 4, 3, false };
+
+/*
+ * Set when the running search should unwind as fast as possible. Searches
+ *  that are stopped return garbage scores which must be discarded.
+ *
+ * @users negamax, selectBestMove
+ * @modifiers stopSearch, negamax, selectBestMove
+ */
+static atomic_bool search_stop;
+
+/*
+ * Set while the running search is on the opponent's time, the clock isn't
+ *  checked until the opponent plays the expected move
+ *
+ * @users negamax, iterativeDeepening, rootSplitSearch, selectBestMove
+ * @modifiers startPonder, finishPonder
+ */
+static atomic_bool search_pondering;
+
+/*
+ * Wall clock time (see wallTime()) at which the running search must stop,
+ *  0 if the search is not time limited
+ *
+ * @users negamax
+ * @modifiers selectBestMove, finishPonder
+ */
+static _Atomic double search_deadline;
+
+#ifdef PARALLEL_NEGAMAX
+/*
+ * Set while a PARALLEL_YBWC search is running, to let negamax make split
+ *  points
+ *
+ * @users negamax
+ * @modifiers selectBestMove
+ */
+static bool search_split = false;
+#endif
+
+/*
+ * Move ordering tables for each search thread, indexed by thread number
+ *
+ * @users negamax
+ * @modifiers selectBestMove, updateHeuristics
+ * @initializer initSearchArenas
+ */
+static heuristics * search_heuristics = NULL;
+
+/*
+ * Counters for each search thread, indexed by thread number
+ *
+ * @users selectBestMove
+ * @modifiers negamax, quiesce, iterativeDeepening, rootSplitSearch
+ * @initializer initSearchArenas
+ */
+static searchstats * search_stats = NULL;
+
+/*
+ * Root states for each search thread, ROOT_STATES to a thread, and the number
+ *  of threads there's room for. Below the root moves are made and unmade in
+ *  place, with each node's moves in its movepicker on the stack.
+ *
+ * @users selectBestMove
+ * @modifiers iterativeDeepening, rootSplitSearch
+ * @initializer initSearchArenas
+ */
+static chessboard * search_roots = NULL;
+static int search_arena_threads = 0;
+
+/*
+ * Wall clock time the running search started at, and how long it has
+ *
+ * @users iterativeDeepening, rootSplitSearch
+ * @modifiers selectBestMove, finishPonder
+ */
+static _Atomic double search_start;
+static _Atomic double search_limit;
+
 /*
  * Does a search for and returns the best move for the board
  *
+ * Searches with iterative deepening, depth 1, 2, 3... until either max_depth
+ *  has been searched or the time limit runs out. The move returned is the
+ *  best move of the last iteration that completed.
+ *
  * @owner Js
  *
+ * @uses search_options
+ *
  * @param self_white true if we are white
  * @param initial A pointer to the initial board state to use
  * @param result A pointer that will be filled with the new board state based
- *               on the function's selected best move. last_piece and last_move
- *               will be set to the value of the piece & location to move it to
- * @param depth The depth to search to
+ *               on the function's selected best move. last_from and last_move
+ *               will be set to the locations to move the piece from & to
+ * @param tlimit The amount of time to spend on the search in seconds, 0 for
+ *               no limit
+ * @param max_depth The deepest iteration to search
+ * @return The score of the selected move
  */
-void selectBestMove(bool self_white, chessboard * restrict const initial,
-        chessboard * restrict result, uint8_t depth)
+int selectBestMove(bool self_white, chessboard * restrict const initial,
+        chessboard * restrict result, double tlimit, uint8_t max_depth)
 {
+    //Set up the clock
+    search_start = wallTime();
+    search_limit = tlimit;
+    search_deadline = (tlimit > 0) ? search_start + tlimit : 0;
+    //startPonder() resets a ponder search itself, so that it can be called
+    //  off before it gets here
+    if (!atomic_load(&search_pondering))
+    {
+        atomic_store(&search_stop, false);
+    }
+
+    //The storage was sized for the threads at startup
+    int threadcount = searchThreads();
+    assert(search_arena_threads > 0);
+    if (threadcount > search_arena_threads)
+    {
+        threadcount = search_arena_threads;
+    }
 #ifdef DEBUG_SEARCH
+    printf("THREADS: %d\n", threadcount);
     puts("setting up storage");
 #endif
 
-    boardset baseStates;
-    baseStates.count = 0;
-    baseStates.data = NULL;
-
-    const size_t futurestore_states = depth - 1;
-
-#ifndef PARALLEL_NEGAMAX
-    boardset * future_states = calloc(futurestore_states, sizeof(boardset));
-#else
-    int thread;
-
-#ifdef USE_MAX_THREADS
-    int threadcount = omp_get_max_threads();
-#ifdef DEBUG_SEARCH
-    printf("MAX_THREADS: %d\n", threadcount);
-#endif
-#else
-    int threadcount = 4;
-#endif
+    //Move ordering starts fresh for each search, as do the counters
+    memset(search_heuristics, 0, (size_t) threadcount * sizeof(heuristics));
+    memset(search_stats, 0, (size_t) threadcount * sizeof(searchstats));
 
-    omp_set_num_threads(threadcount);
-    boardset * future_states[threadcount];
-    for (uint8_t i = 0; i < threadcount; ++i)
+    //Each thread gets its own root states, the rest of the search makes
+    //  and unmakes moves on them in place. There's room for every move
+    boardset baseStates[threadcount];
+    for (int i = 0; i < threadcount; ++i)
     {
-        future_states[i] = calloc(futurestore_states, sizeof(boardset));
+        baseStates[i].count = MAX_MOVES;
+        baseStates[i].data = &search_roots[i * ROOT_STATES];
     }
-#endif
 
 #ifdef DEBUG_SEARCH
     puts("doing initial expansion");
 #endif
 
     //Do the first expansion
-#ifndef PARALLEL_NEGAMAX
-    uint8_t states = expandStates(initial, &baseStates, self_white);
-#else
-    uint8_t states = expandStates(initial, &baseStates, self_white);
-#endif
+    uint8_t states = expandStates(initial, &baseStates[0], self_white);
 
-    //Best value seen
-#ifndef PARALLEL_NEGAMAX
-    int best = INT_MIN;
-    uint8_t best_indx = 0;
-#else
-    int best[threadcount];
-    uint8_t best_indx[threadcount];
-    for (uint8_t i = 0; i < threadcount; ++i)
+    //Checkmate or stalemate, there's nothing to pick from
+    if (!states)
     {
-        best[i] = INT_MIN;
-        best_indx[i] = 0;
+        memcpy(result, initial, sizeof(chessboard));
+        return ((inCheck(initial, self_white)) ? -MATE_SCORE : 0);
     }
-#endif
-
-    //Currently seen value
-    int cur;
 
-#ifdef DEBUG_SEARCH
-    puts("starting search");
-#endif
+    //Best move & its score
+    uint8_t best_indx = 0;
+    int best;
 
-    //Do the search
 #ifdef PARALLEL_NEGAMAX
-#pragma omp parallel for private(cur, thread) \
-    shared(best_indx, best, states, baseStates, future_states, self_white, depth)
-#endif
-    for (uint8_t i = 0; i < states; ++i)
+    if (threadcount > 1 && search_options.parallel_mode == PARALLEL_LAZY_SMP)
     {
-        //Already did depth 0, so do the rest
-        //  depth 0 values won't be over-written, so we can just look up
-        //  the data we want after the loop ends
-#ifndef PARALLEL_NEGAMAX
-        cur = -negamax(&baseStates.data[i], !self_white, future_states, -INT_MAX,
-                INT_MAX, depth - 1);
-        if (cur > best)
+        //Every thread searches the whole tree, helpers only contribute
+        //  through the transposition table
+#pragma omp parallel num_threads(threadcount) \
+    shared(baseStates, best, best_indx)
         {
-            best = cur;
-            best_indx = i;
+            int thread = omp_get_thread_num();
+            uint8_t helper_indx;
+
+            if (thread)
+            {
+                expandStates(initial, &baseStates[thread], self_white);
+                iterativeDeepening(self_white, &baseStates[thread], states,
+                        max_depth, thread, &helper_indx);
+            }
+            else
+            {
+                best = iterativeDeepening(self_white, &baseStates[0], states,
+                        max_depth, 0, &best_indx);
+                //Done, so call off the helpers
+                stopSearch();
+            }
         }
-#else
-        thread = omp_get_thread_num();
-        cur = -negamax(&baseStates.data[i], !self_white, future_states[thread],
-                -INT_MAX, INT_MAX, depth - 1);
-        if (cur > best[thread])
+    }
+    else if (threadcount > 1
+            && search_options.parallel_mode == PARALLEL_YBWC)
+    {
+        //One thread runs the search, the others pick up the siblings
+        //  handed out at split points
+        search_split = true;
+#pragma omp parallel num_threads(threadcount) \
+    shared(baseStates, best, best_indx)
+#pragma omp single
         {
-            best[thread] = cur;
-            best_indx[thread] = i;
+            best = iterativeDeepening(self_white, &baseStates[0], states,
+                    max_depth, 0, &best_indx);
         }
-#endif
-#ifdef DEBUG_SEARCH
-        printf("tl @ %d of %d\n", i + 1, states);
-#endif
+        search_split = false;
+    }
+    else if (threadcount > 1)
+    {
+        best = rootSplitSearch(self_white, &baseStates[0], states,
+                max_depth, threadcount, &best_indx);
     }
+    else
+    {
+        //A single thread searches the same way as without PARALLEL_NEGAMAX
+        best = iterativeDeepening(self_white, &baseStates[0], states,
+                max_depth, 0, &best_indx);
+    }
+#else
+    best = iterativeDeepening(self_white, &baseStates[0], states, max_depth,
+            0, &best_indx);
+#endif
 
 #ifdef DEBUG_SEARCH
     puts("search complete");
 #endif
 
-#ifndef PARALLEL_NEGAMAX
     //Get best board state
-    memcpy(result, &baseStates.data[best_indx], sizeof(chessboard));
-    //Free used memory
-    for (uint8_t i = 0; i < futurestore_states; ++i)
+    memcpy(result, &baseStates[0].data[best_indx], sizeof(chessboard));
+
+    searchstats totals;
+    mergeStats(search_stats, threadcount, &totals);
+    printStats(&totals, wallTime() - search_start);
+
+    return (best);
+}
+
+/*
+ * Works out how many threads a search runs on, search_options.threads if
+ *  it was given, otherwise as many as OpenMP offers with USE_MAX_THREADS or
+ *  4 without. Always 1 without PARALLEL_NEGAMAX.
+ *
+ * @owner Js
+ *
+ * @uses search_options
+ *
+ * @return The number of search threads
+ */
+int searchThreads(void)
+{
+#ifdef PARALLEL_NEGAMAX
+    int threadcount = search_options.threads;
+    if (threadcount < 1)
     {
-        free(future_states[i].data);
+#ifdef USE_MAX_THREADS
+        threadcount = omp_get_max_threads();
+#else
+        threadcount = 4;
+#endif
     }
-    free(future_states);
+    return (threadcount);
 #else
-    //Get thread best
-    int th_best = best[0];
-    uint8_t th_best_i = best_indx[0];
+    return (1);
+#endif
+}
+
+/*
+ * Allocates the storage every search reuses, for searchThreads() threads.
+ *  Any existing storage is freed first. Each thread's tables & root states
+ *  start on their own cache line, so no search allocates while it runs.
+ *
+ * @owner Js
+ *
+ * @modifies search_heuristics, search_stats, search_roots,
+ *           search_arena_threads
+ *
+ * @return true if the storage was allocated
+ */
+bool initSearchArenas(void)
+{
+    int threadcount = searchThreads();
+    //aligned_alloc() needs a whole number of cache lines
+    size_t ordering = ((size_t) threadcount * sizeof(heuristics) + 63)
+            & ~(size_t) 63;
+    size_t roots = (size_t) threadcount * ROOT_STATES * sizeof(chessboard);
+
+    //Each thread's root states must end on a cache line for the next
+    //  thread's to start on one
+    assert(ROOT_STATES * sizeof(chessboard) % 64 == 0);
+
+    freeSearchArenas();
+
+    search_heuristics = aligned_alloc(64, ordering);
+    search_stats = aligned_alloc(_Alignof(searchstats),
+            (size_t) threadcount * sizeof(searchstats));
+    search_roots = aligned_alloc(64, roots);
+    if (!search_heuristics || !search_stats || !search_roots)
+    {
+        freeSearchArenas();
+        return (false);
+    }
+
+    search_arena_threads = threadcount;
+    return (true);
+}
+
+/*
+ * Frees the storage allocated by initSearchArenas()
+ *
+ * @owner Js
+ *
+ * @modifies search_heuristics, search_stats, search_roots,
+ *           search_arena_threads
+ */
+void freeSearchArenas(void)
+{
+    free(search_heuristics);
+    search_heuristics = NULL;
+    free(search_stats);
+    search_stats = NULL;
+    free(search_roots);
+    search_roots = NULL;
+    search_arena_threads = 0;
+}
+
+/*
+ * Runs an iterative deepening search over a set of root states on the
+ *  calling thread, until max_depth has been searched or the search is
+ *  stopped.
+ *
+ * Thread 0 is the main thread, and is the only one that manages the clock.
+ *  Odd numbered helper threads search a ply ahead of the others so that
+ *  Lazy SMP threads are spread over two depths.
+ *
+ * Each iteration starts with an aspiration window around the score of the
+ *  last, and is searched again with a wider window if it falls outside.
+ *
+ * @owner Js
+ *
+ * @param self_white true if we are white
+ * @param roots The expanded root states. These are reordered so that the
+ *              best move of each iteration is searched first in the next
+ * @param states The number of root states
+ * @param max_depth The deepest iteration to search
+ * @param thread The number of the calling thread
+ * @param best_indx Filled with the index into roots of the best move of the
+ *                  last completed iteration
+ * @return The score of the best move of the last completed iteration
+ */
+int iterativeDeepening(bool self_white, boardset * roots, uint8_t states,
+        uint8_t max_depth, int thread, uint8_t * best_indx)
+{
+    //Best move & score of the last completed iteration
+    int completed_score = 0;
+    bool completed = false;
+    *best_indx = 0;
+
+    //Best value seen
+    int best;
+    uint8_t indx;
+
+    //Aspiration window
+    int alpha, beta;
 
-    for (uint8_t i = 1; i < threadcount; ++i)
+    for (uint8_t depth = 1 + (thread & 1); depth <= max_depth; ++depth)
     {
-        if (best[i] > th_best)
+#ifdef DEBUG_SEARCH
+        printf("%d: starting search, depth %d\n", thread, depth);
+#endif
+
+        //The score usually doesn't move far between iterations, so start
+        //  with a window around the last one
+        alpha = (completed) ? completed_score - ASPIRATION_WINDOW : -INT_MAX;
+        beta = (completed) ? completed_score + ASPIRATION_WINDOW : INT_MAX;
+
+        while (true)
+        {
+            best = searchRoot(self_white, roots, states, alpha, beta, depth,
+                    &indx);
+
+            if (atomic_load(&search_stop))
+            {
+                break;
+            }
+
+            //Outside the window, the score is only a bound so search again
+            //  with that side of the window opened up
+            if (best <= alpha && alpha != -INT_MAX)
+            {
+                alpha = -INT_MAX;
+            }
+            else if (best >= beta && beta != INT_MAX)
+            {
+                beta = INT_MAX;
+            }
+            else
+            {
+                break;
+            }
+
+#ifdef DEBUG_SEARCH
+            printf("%d: aspiration failed, %d\n", thread, best);
+#endif
+        }
+
+        if (atomic_load(&search_stop))
         {
-            th_best = best[i];
-            th_best_i = best_indx[i];
+            //Stopped partway through, the iteration is incomplete
+            break;
         }
-    }
 
-    //copy into result
-    memcpy(result, &baseStates.data[th_best_i], sizeof(chessboard));
+        completed_score = best;
+        completed = true;
+
+        if (!thread)
+        {
+            recordIteration(&search_stats[0], wallTime() - search_start);
+        }
 
 #ifdef DEBUG_SEARCH
-    puts("freeing thread mem");
+        printf("%d: depth %d complete, best %d, %f seconds\n", thread, depth,
+                best, wallTime() - search_start);
 #endif
-    //Free used memory
-    for (uint8_t j = 0; j < threadcount; ++j)
-    {
-        for (uint8_t i = 0; i < depth - 1; ++i)
+
+        //Search the best move first in the next iteration
+        if (indx)
         {
-            free(future_states[j][i].data);
+            chessboard tmp = roots->data[0];
+            roots->data[0] = roots->data[indx];
+            roots->data[indx] = tmp;
+        }
+
+        //The next iteration takes several times as long as this one, so
+        //  don't start it if it can't finish
+        if (!thread && search_deadline && !atomic_load(&search_pondering)
+                && (wallTime() - search_start) * 2 > search_limit)
+        {
+            break;
         }
-        free(future_states[j]);
     }
-#endif
+
+    return (completed_score);
 }
 
 /*
- * Performs a standard negamax search
- *
- * The callee is responsible for doing the first expansion & call to negamax
- *  for each root node, as well as determining which root node to use.
+ * Searches a set of root states to a depth with principal variation search
  *
  * @owner Js
  *
- * @param state A pointer to the start state for the layer
- * @param white If the current layer of the search is from white or black's
- *          perspective
- * @param expansionStore An array of chessboard * to use for storing expanded
- *                       states. These may be realloc'd during execution of
- *                       the search.
- *                       !!! It is assumed to contain at least as many
- *                       pointers as the maximum depth of the search. Supplying
- *                       less will result in out of bounds memory access. !!!
- * @param alpha Best value seen
- * @param beta The cutoff, should initially be INT_MAX - 1, NOT INT_MAX
- * @param depth The depth to traverse to
+ * @param self_white true if we are white
+ * @param roots The expanded root states
+ * @param states The number of root states
+ * @param alpha Lower bound of the window
+ * @param beta Upper bound of the window
+ * @param depth The depth to search to
+ * @param best_indx Filled with the index into roots of the best move
+ * @return The score of the best move, a bound if outside alpha..beta
  */
-int negamax(chessboard * const state, bool white, boardset * expansionStore,
-        int alpha, int beta, uint8_t depth)
+int searchRoot(bool self_white, boardset * roots, uint8_t states,
+        int alpha, int beta, uint8_t depth, uint8_t * best_indx)
 {
-    //Check if end of depth or opponent king captured
-    if (!depth || (state->b_piece_posns[15] == CAPTURED)
-            || (state->w_piece_posns[15] == CAPTURED))
+    int best = INT_MIN;
+    int cur;
+    *best_indx = 0;
+
+    for (uint8_t i = 0; i < states; ++i)
     {
-        //Return value of state
-        return (evaluateState(state, white));
+        if (i == 0)
+        {
+            cur = -negamax(&roots->data[i], !self_white, -beta, -alpha,
+                    depth - 1, 1, NULL);
+        }
+        else
+        {
+            //Null window, re-search only if it beats the best so far
+            cur = -negamax(&roots->data[i], !self_white, -alpha - 1,
+                    -alpha, depth - 1, 1, NULL);
+            if (cur > alpha && cur < beta)
+            {
+                cur = -negamax(&roots->data[i], !self_white, -beta,
+                        -alpha, depth - 1, 1, NULL);
+            }
+        }
+
+        if (cur > best)
+        {
+            best = cur;
+            *best_indx = i;
+            if (cur >= beta)
+            {
+                break;
+            }
+            if (cur > alpha)
+            {
+                alpha = cur;
+            }
+        }
     }
-    else
+
+    return (best);
+}
+
+#ifdef PARALLEL_NEGAMAX
+/*
+ * Runs an iterative deepening search, splitting the root moves of each
+ *  iteration between threads. Moves are handed out one at a time in order,
+ *  and every thread searches with the best score found by any thread so far
+ *  as its alpha.
+ *
+ * @owner Js
+ *
+ * @param self_white true if we are white
+ * @param roots The expanded root states. These are reordered by score after
+ *              each iteration so that the next searches the best first
+ * @param states The number of root states
+ * @param max_depth The deepest iteration to search
+ * @param threadcount The number of threads to search with
+ * @param best_indx Filled with the index into roots of the best move of the
+ *                  last completed iteration
+ * @return The score of the best move of the last completed iteration
+ */
+int rootSplitSearch(bool self_white, boardset * roots, uint8_t states,
+        uint8_t max_depth, int threadcount, uint8_t * best_indx)
+{
+    int thread;
+
+    //Best move & score of the last completed iteration
+    int completed_score = 0;
+    *best_indx = 0;
+
+    //Best exact value each thread has seen
+    int best[threadcount];
+    uint8_t indx[threadcount];
+
+    //Score of each root move in the iteration, exact for the best and an
+    //  upper bound for the rest, used to order the next iteration
+    int scores[states];
+
+    //Best score any thread has found so far in the iteration, shared so
+    //  that each root move is searched with the narrowest window available
+    atomic_int root_alpha;
+
+    //Currently seen value
+    int cur;
+    int alpha;
+
+    chessboard tmp;
+    uint8_t j;
+
+    for (uint8_t depth = 1; depth <= max_depth; ++depth)
     {
-        //best score at this height
-        int best = INT_MIN;
-        //Currently seen value
-        int cur;
-        //Storage of expanded states
-        boardset * storage = &expansionStore[depth - 1];
+        for (int i = 0; i < threadcount; ++i)
+        {
+            best[i] = INT_MIN;
+            indx[i] = 0;
+        }
+        atomic_store(&root_alpha, -INT_MAX);
 
-        //Do expansion, store result
-        uint8_t states = expandStates(state, storage, white);
+#ifdef DEBUG_SEARCH
+        printf("starting search, depth %d\n", depth);
+#endif
 
-        //recurse negamax for each state expanded
+        //Do the search, handing out moves one at a time in order so that no
+        //  thread is left holding a block of expensive moves
+#pragma omp parallel for num_threads(threadcount) schedule(dynamic, 1) \
+    private(cur, alpha, thread) \
+    shared(indx, best, scores, root_alpha, states, roots, self_white, depth)
         for (uint8_t i = 0; i < states; ++i)
         {
-            cur = -negamax(&storage->data[i], !white, expansionStore, -beta,
-                    -alpha, depth - 1);
-            if (cur >= beta)
+            thread = omp_get_thread_num();
+            alpha = atomic_load(&root_alpha);
+
+            if (alpha == -INT_MAX)
             {
-                // fail-soft beta cutoff
-                //  Beta is the the best value that the calling node has seen,
-                //  so if we return a value that is better for us than the
-                //  calling node, then the calling node will go ahead and
-                //  select the other value anyways.
-                return (cur);
+                //Nothing to beat yet, needs a real score
+                cur = -negamax(&roots->data[i], !self_white, -INT_MAX,
+                        INT_MAX, depth - 1, 1, NULL);
             }
-            if (cur > best)
+            else
             {
-                //Found a better value
-                best = cur;
+                //Null window, re-search only if it beats the best so far
+                cur = -negamax(&roots->data[i], !self_white, -alpha - 1,
+                        -alpha, depth - 1, 1, NULL);
                 if (cur > alpha)
                 {
-                    //Best score for level & better than alpha
-                    alpha = cur;
+                    cur = -negamax(&roots->data[i], !self_white, -INT_MAX,
+                            -alpha, depth - 1, 1, NULL);
                 }
             }
+
+            //Only a score above the alpha it was searched with is exact, a
+            //  null window that failed low is a bound that could tie
+            //  another thread's exact score, so it can't be the best
+            scores[i] = cur;
+            if (cur > alpha && cur > best[thread])
+            {
+                best[thread] = cur;
+                indx[thread] = i;
+            }
+
+            //Raise the shared alpha if this beat it
+            alpha = atomic_load(&root_alpha);
+            while (cur > alpha
+                    && !atomic_compare_exchange_weak(&root_alpha, &alpha, cur))
+            {
+            }
+#ifdef DEBUG_SEARCH
+            printf("tl @ %d of %d\n", i + 1, states);
+#endif
         }
-        //Return the best value
-        return (best);
+
+        if (atomic_load(&search_stop))
+        {
+            //Ran out of time partway through, the iteration is incomplete
+            break;
+        }
+
+        //Get thread best
+        for (int i = 1; i < threadcount; ++i)
+        {
+            if (best[i] > best[0])
+            {
+                best[0] = best[i];
+                indx[0] = indx[i];
+            }
+        }
+        completed_score = best[0];
+        recordIteration(&search_stats[0], wallTime() - search_start);
+
+#ifdef DEBUG_SEARCH
+        printf("depth %d complete, best %d, %f seconds\n", depth,
+                completed_score, wallTime() - search_start);
+#endif
+
+        //The best move must go first, even if another move tied its bound
+        scores[indx[0]] = INT_MAX;
+
+        //Order the next iteration best first, insertion sort is stable so
+        //  moves that failed low together keep their order
+        for (uint8_t i = 1; i < states; ++i)
+        {
+            tmp = roots->data[i];
+            cur = scores[i];
+            for (j = i; j > 0 && scores[j - 1] < cur; --j)
+            {
+                scores[j] = scores[j - 1];
+                roots->data[j] = roots->data[j - 1];
+            }
+            scores[j] = cur;
+            roots->data[j] = tmp;
+        }
+
+        //The next iteration takes several times as long as this one, so
+        //  don't start it if it can't finish
+        if (search_deadline && !atomic_load(&search_pondering)
+                && (wallTime() - search_start) * 2 > search_limit)
+        {
+            break;
+        }
+    }
+
+    return (completed_score);
+}
+
+/*
+ * Searches the remaining moves of a node in parallel once its first move
+ *  has been searched. Each move becomes a task that idle threads can pick
+ *  up, on their own copy of the node, and a move that fails high stops its
+ *  siblings.
+ *
+ * @owner Js
+ *
+ * @param state The node being split
+ * @param white If the node is from white or black's perspective
+ * @param moves The moves of the node left to search, after the first, in
+ *              the order to search them
+ * @param count The number of moves
+ * @param alpha Best value seen
+ * @param beta The cutoff
+ * @param depth The depth of the node
+ * @param ply The distance of the node from the root
+ * @param best The score of the first move
+ * @param best_move The first move, filled with the best move
+ * @param parent The innermost split point the node is under, NULL if none
+ * @return The best score of the node
+ */
+int splitSearch(chessboard * const state, bool white, chessmove moves[],
+        uint8_t count, int alpha, int beta, uint8_t depth, uint8_t ply,
+        int best, chessmove * best_move, splitpoint * parent)
+{
+    splitpoint split;
+    atomic_init(&split.stop, false);
+    atomic_init(&split.alpha, alpha);
+    split.parent = parent;
+    split.best = best;
+    split.best_move = *best_move;
+
+    for (uint8_t i = 0; i < count; ++i)
+    {
+#pragma omp task firstprivate(i) shared(split)
+        {
+            //Don't bother starting if a sibling has already failed high
+            if (!splitStopped(&split))
+            {
+                //Tasks can run on any thread, so each needs its own board
+                chessboard child = *state;
+                undoinfo undo;
+                doMove(&child, moves[i], white, &undo);
+
+                //Null window first, like negamax
+                int alpha_now = atomic_load(&split.alpha);
+                int cur = -negamax(&child, !white, -alpha_now - 1,
+                        -alpha_now, depth - 1, ply + 1, &split);
+                if (cur > alpha_now && cur < beta)
+                {
+                    cur = -negamax(&child, !white, -beta, -alpha_now,
+                            depth - 1, ply + 1, &split);
+                }
+
+                //If stopped cur is meaningless
+                if (!splitStopped(&split))
+                {
+#pragma omp critical(splitpoint)
+                    {
+                        if (cur > split.best)
+                        {
+                            split.best = cur;
+                            split.best_move = moves[i];
+                            if (cur >= beta)
+                            {
+                                //fail high, call off the siblings
+                                atomic_store(&split.stop, true);
+                            }
+                            else if (cur > atomic_load(&split.alpha))
+                            {
+                                atomic_store(&split.alpha, cur);
+                            }
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    //Wait for the siblings, this thread can help out with them
+#pragma omp taskwait
+
+    *best_move = split.best_move;
+    return (split.best);
+}
+#endif
+
+/*
+ * Sets up a movepicker for a node. Nothing is generated until nextMove()
+ *  needs it, other than the checks against the side to move.
+ *
+ * @owner Js
+ *
+ * @param picker The picker to set up
+ * @param board The node the moves are from, which must not change while
+ *              the picker is in use, other than moves being made and unmade
+ * @param white true if the moves are white's
+ * @param hash_move The best move from the transposition table, or NO_MOVE
+ * @param ordering The move ordering tables of the thread
+ * @param ply The distance of board from the root
+ * @param captures_only true to only hand out captures & promotions
+ */
+void initMovePicker(movepicker * picker, chessboard * const board, bool white,
+        chessmove hash_move, heuristics * ordering, uint8_t ply,
+        bool captures_only)
+{
+    picker->count = 0;
+    picker->next = 0;
+    picker->stage = (captures_only) ? STAGE_GEN_CAPTURES : STAGE_HASH;
+    picker->captures_only = captures_only;
+    picker->board = board;
+    picker->white = white;
+    picker->ply = ply;
+    picker->ordering = ordering;
+    picker->hash_move = hash_move;
+    findChecks(board, white, &picker->checks);
+
+    if (!captures_only && ply < MAX_PLY)
+    {
+        //Don't hand out the same move twice
+        picker->killers[0] = ordering->killers[ply][0];
+        picker->killers[1] = (ordering->killers[ply][1]
+                != picker->killers[0]) ? ordering->killers[ply][1] : NO_MOVE;
+    }
+    else
+    {
+        picker->killers[0] = NO_MOVE;
+        picker->killers[1] = NO_MOVE;
+    }
+}
+
+/*
+ * Hands out a node's next move. The move from the transposition table goes
+ *  first, then captures & promotions by most valuable victim/least valuable
+ *  attacker, then the killer moves, then the countermove, then everything
+ *  else by history score. The hash move and killers are checked against the
+ *  board before being handed out, since they come from other nodes.
+ *
+ * @owner Js
+ *
+ * @param picker The picker of the node
+ * @return The next move, or NO_MOVE once all of them have been handed out
+ */
+chessmove nextMove(movepicker * picker)
+{
+    chessmove mv;
+
+    //Each stage either hands out a move or moves on to the next
+    for (;;)
+    {
+        switch (picker->stage)
+        {
+        case STAGE_HASH:
+            ++picker->stage;
+            if (picker->hash_move != NO_MOVE
+                    && validMove(picker->board, picker->white,
+                            &picker->checks, picker->hash_move))
+            {
+                return (picker->hash_move);
+            }
+            break;
+
+        case STAGE_GEN_CAPTURES:
+            picker->count = generateMoves(picker->board, picker->white,
+                    GEN_CAPTURES, &picker->checks, picker->moves);
+            picker->next = 0;
+            scoreMoves(picker);
+            ++picker->stage;
+            break;
+
+        case STAGE_CAPTURES:
+            while ((mv = pickMove(picker)) != NO_MOVE)
+            {
+                if (mv != picker->hash_move)
+                {
+                    return (mv);
+                }
+            }
+            picker->next = 0;
+            picker->stage = (picker->captures_only) ? STAGE_DONE :
+                    STAGE_KILLERS;
+            break;
+
+        case STAGE_KILLERS:
+            //Killers are quiet, anything else was handed out with the
+            //  captures
+            while (picker->next < 2)
+            {
+                mv = picker->killers[picker->next++];
+                if (mv != NO_MOVE && mv != picker->hash_move
+                        && !(MOVE_FLAGS(mv) & (MOVE_CAPTURE | MOVE_PROMOTION))
+                        && validMove(picker->board, picker->white,
+                                &picker->checks, mv))
+                {
+                    return (mv);
+                }
+            }
+            ++picker->stage;
+            break;
+
+        case STAGE_GEN_QUIETS:
+            picker->count = generateMoves(picker->board, picker->white,
+                    GEN_QUIETS, &picker->checks, picker->moves);
+            picker->next = 0;
+            scoreMoves(picker);
+            ++picker->stage;
+            break;
+
+        case STAGE_QUIETS:
+            while ((mv = pickMove(picker)) != NO_MOVE)
+            {
+                if (mv != picker->hash_move && mv != picker->killers[0]
+                        && mv != picker->killers[1])
+                {
+                    return (mv);
+                }
+            }
+            ++picker->stage;
+            break;
+
+        default:
+            return (NO_MOVE);
+        }
+    }
+}
+
+/*
+ * Gives the moves of the picker's current stage their ordering scores
+ *
+ * @owner Js
+ *
+ * @uses mvv_lva_ranks, promotion_codes
+ *
+ * @param picker The picker with a newly generated stage
+ */
+void scoreMoves(movepicker * picker)
+{
+    chessboard * board = picker->board;
+    bool white = picker->white;
+    heuristics * ordering = picker->ordering;
+
+    //Parent data
+    bitboard op = (white) ? board->all_b_pieces : board->all_w_pieces;
+
+    uint8_t last, flags;
+    chessmove mv;
+    int score;
+
+    //Quiet move tables for the node
+    uint32_t (*history)[64] = ordering->history[(white) ? 0 : 1];
+    chessmove counter = NO_MOVE;
+
+    //The opponent's last move, to look up the countermove. The piece may
+    //  have been taken since if the opponent then passed
+    last = (white) ? board->state.b_last_move : board->state.w_last_move;
+    if (last != INVALID_SQUARE && (location_boards[last] & op))
+    {
+        counter = ordering->countermoves[PIECE_AT(board, last)][last];
+    }
+
+    for (uint8_t i = 0; i < picker->count; ++i)
+    {
+        mv = picker->moves[i];
+        flags = MOVE_FLAGS(mv);
+
+        if (flags & (MOVE_CAPTURE | MOVE_PROMOTION))
+        {
+            //Capture, most valuable victim first, then least valuable
+            //  attacker. Promotions are ordered as if they captured the new
+            //  piece
+            score = -mvv_lva_ranks[PIECE_AT(board, MOVE_FROM(mv))];
+            if (flags & MOVE_CAPTURE)
+            {
+                score += 8 * mvv_lva_ranks[PIECE_AT(board, MOVE_TO(mv))];
+            }
+            if (flags & MOVE_PROMOTION)
+            {
+                score += 8 * mvv_lva_ranks[promotion_codes[flags
+                        & PROMOTE_MASK]];
+            }
+        }
+        else if (mv == counter)
+        {
+            score = COUNTER_SCORE;
+        }
+        else
+        {
+            score = (int) history[MOVE_FROM(mv)][MOVE_TO(mv)];
+        }
+
+        picker->scores[i] = score;
+    }
+}
+
+/*
+ * Takes the best scored move left in the picker's current stage, a
+ *  selection sort one move at a time, since the rest often aren't needed
+ *
+ * @owner Js
+ *
+ * @param picker The picker of the node
+ * @return The move, or NO_MOVE if the stage has run out
+ */
+chessmove pickMove(movepicker * picker)
+{
+    uint8_t best = picker->next;
+    chessmove mv;
+    int score;
+
+    if (picker->next >= picker->count)
+    {
+        return (NO_MOVE);
+    }
+
+    //The first of equal scores wins
+    for (uint8_t i = picker->next + 1; i < picker->count; ++i)
+    {
+        if (picker->scores[i] > picker->scores[best])
+        {
+            best = i;
+        }
+    }
+
+    //Swap it to the front of what's left
+    mv = picker->moves[best];
+    score = picker->scores[best];
+    picker->moves[best] = picker->moves[picker->next];
+    picker->scores[best] = picker->scores[picker->next];
+    picker->moves[picker->next] = mv;
+    picker->scores[picker->next] = score;
+    ++picker->next;
+
+    return (mv);
+}
+
+/*
+ * Records a move that caused a beta cutoff in the move ordering tables.
+ *  Captures & promotions are already ordered well, so only quiet moves are
+ *  recorded.
+ *
+ * @owner Js
+ *
+ * @param ordering The move ordering tables of the thread
+ * @param board The node that failed high
+ * @param white true if it's white's move at board
+ * @param mv The move that caused the cutoff
+ * @param depth The depth of board
+ * @param ply The distance of board from the root
+ */
+void updateHeuristics(heuristics * ordering, chessboard * const board,
+        bool white, chessmove mv, uint8_t depth, uint8_t ply)
+{
+    uint8_t from = MOVE_FROM(mv);
+    uint8_t to = MOVE_TO(mv);
+    bitboard op = (white) ? board->all_b_pieces : board->all_w_pieces;
+
+    //Captures and promotions aren't quiet
+    if (MOVE_FLAGS(mv) & (MOVE_CAPTURE | MOVE_PROMOTION))
+    {
+        return;
+    }
+
+    if (ply < MAX_PLY && ordering->killers[ply][0] != mv)
+    {
+        ordering->killers[ply][1] = ordering->killers[ply][0];
+        ordering->killers[ply][0] = mv;
+    }
+
+    //Deeper cutoffs save more work, so they count for more
+    uint32_t (*history)[64] = ordering->history[(white) ? 0 : 1];
+    history[from][to] += (uint32_t) depth * depth;
+    if (history[from][to] >= HISTORY_MAX)
+    {
+        //Age the whole table so the scores stay below the countermove's
+        for (uint8_t i = 0; i < 64; ++i)
+        {
+            for (uint8_t j = 0; j < 64; ++j)
+            {
+                history[i][j] /= 2;
+            }
+        }
+    }
+
+    //The move that refuted the opponent's last move
+    uint8_t last = (white) ? board->state.b_last_move
+            : board->state.w_last_move;
+    if (last != INVALID_SQUARE && (location_boards[last] & op))
+    {
+        ordering->countermoves[PIECE_AT(board, last)][last] = mv;
+    }
+}
+
+/*
+ * Records the end of an iteration in the main thread's counters
+ *
+ * @param stats The counters of the main thread
+ * @param elapsed The time since the search started
+ */
+void recordIteration(searchstats * stats, double elapsed)
+{
+    if (stats->iterations < MAX_PLY)
+    {
+        stats->iteration_time[stats->iterations] = elapsed;
+        stats->iteration_nodes[stats->iterations] = stats->nodes;
+        ++stats->iterations;
+    }
+}
+
+/*
+ * Adds up the counters of all of the search threads
+ *
+ * @param stats The counters of each thread, the first being the main thread
+ * @param threadcount The number of threads
+ * @param out Filled with the totals, and the iterations of the main thread
+ */
+void mergeStats(searchstats * stats, int threadcount, searchstats * out)
+{
+    memcpy(out, &stats[0], sizeof(searchstats));
+
+    for (int i = 1; i < threadcount; ++i)
+    {
+        out->nodes += stats[i].nodes;
+        out->leaves += stats[i].leaves;
+        out->cutoffs += stats[i].cutoffs;
+        out->first_cutoffs += stats[i].first_cutoffs;
+        out->tt_probes += stats[i].tt_probes;
+        out->tt_hits += stats[i].tt_hits;
+    }
+}
+
+/*
+ * Prints the counters of a search as a single line of key=value pairs,
+ *  prefixed with "stats". The effective branching factor is the ratio of
+ *  the nodes in the last two iterations, as seen by the main thread, and
+ *  the iteration times are the time each iteration took.
+ *
+ * @param stats The merged counters of the search
+ * @param elapsed The time the search took
+ */
+void printStats(searchstats * stats, double elapsed)
+{
+    uint8_t n = stats->iterations;
+    double ebf = 0;
+
+    if (n >= 3)
+    {
+        uint64_t last = stats->iteration_nodes[n - 1]
+                - stats->iteration_nodes[n - 2];
+        uint64_t prev = stats->iteration_nodes[n - 2]
+                - stats->iteration_nodes[n - 3];
+        ebf = (prev) ? (double) last / (double) prev : 0;
+    }
+
+    printf("stats depth=%d nodes=%" PRIu64 " leaves=%" PRIu64 " nps=%.0f"
+            " cutoffs=%" PRIu64 " first_cutoff_pct=%.1f tt_probes=%" PRIu64
+            " tt_hits=%" PRIu64 " ebf=%.2f time=%.3f iteration_times=",
+            (int) n, stats->nodes, stats->leaves,
+            (elapsed > 0) ? (double) stats->nodes / elapsed : 0,
+            stats->cutoffs,
+            (stats->cutoffs) ?
+                    100.0 * (double) stats->first_cutoffs
+                            / (double) stats->cutoffs : 0,
+            stats->tt_probes, stats->tt_hits, ebf, elapsed);
+
+    //The times are kept since the start of the search, each is printed less
+    //  the one before it
+    for (uint8_t i = 0; i < n; ++i)
+    {
+        printf((i) ? ",%.3f" : "%.3f", stats->iteration_time[i]
+                - ((i) ? stats->iteration_time[i - 1] : 0));
+    }
+    putchar('\n');
+}
+
+/*
+ * Checks if a split point, or any split point above it, has been stopped
+ *
+ * @param split The split point to check, NULL is never stopped
+ * @return true if the search under split should be abandoned
+ */
+bool splitStopped(splitpoint * split)
+{
+    for (; split; split = split->parent)
+    {
+        if (atomic_load_explicit(&split->stop, memory_order_relaxed))
+        {
+            return (true);
+        }
+    }
+
+    return (false);
+}
+
+/*
+ * Stops any running search. The search will return the best move from its
+ *  last completed iteration.
+ *
+ * @modifies search_stop
+ */
+void stopSearch(void)
+{
+    atomic_store(&search_stop, true);
+}
+
+/*
+ * Starts searching on the opponent's time. The opponent's reply is guessed
+ *  from the transposition table, and our reply to it is searched on a
+ *  background thread until finishPonder() is called.
+ *
+ * @owner Js
+ *
+ * @modifies search_pondering, search_stop
+ *
+ * @param ponder Filled with the state of the ponder search
+ * @param self_white true if we are white
+ * @param board The board after our move, with the opponent to move
+ * @param tlimit The time limit of our search once the opponent has moved
+ * @param max_depth The deepest iteration to search
+ * @return true if a ponder search was started, false if there was no reply
+ *         to expect
+ */
+bool startPonder(ponderstate * ponder, bool self_white,
+        chessboard * const board, double tlimit, uint8_t max_depth)
+{
+    ttentry entry;
+    hashkey key = (self_white) ? board->key ^ side_key : board->key;
+
+    if (!probeTransTable(key, &entry) || entry.best == NO_MOVE)
+    {
+        return (false);
+    }
+
+    //Find the expected reply among the opponent's moves
+    chessmove moves[MAX_MOVES];
+    checkinfo checks;
+    undoinfo undo;
+    uint8_t count;
+    uint8_t i;
+
+    findChecks(board, !self_white, &checks);
+    count = generateMoves(board, !self_white, GEN_ALL, &checks, moves);
+    for (i = 0; i < count; ++i)
+    {
+        if (moves[i] == entry.best)
+        {
+            break;
+        }
+    }
+
+    if (i == count)
+    {
+        //An index collision gave a move from some other position
+        return (false);
+    }
+
+    ponder->self_white = self_white;
+    ponder->position = *board;
+    doMove(&ponder->position, moves[i], !self_white, &undo);
+    ponder->tlimit = tlimit;
+    ponder->max_depth = max_depth;
+    memset(ponder->move, 0, sizeof(ponder->move));
+    getMoveString(&ponder->position, board, !self_white, ponder->move);
+
+    atomic_store(&search_pondering, true);
+    atomic_store(&search_stop, false);
+
+    if (pthread_create(&ponder->thread, NULL, ponderSearch, ponder))
+    {
+        atomic_store(&search_pondering, false);
+        return (false);
+    }
+
+    return (true);
+}
+
+/*
+ * Ends a ponder search once the opponent has moved. If they played the
+ *  expected move the ponder search carries on as our search, with the full
+ *  time limit from now. Otherwise it's stopped, but whatever it stored in
+ *  the transposition table is kept.
+ *
+ * @owner Js
+ *
+ * @modifies search_pondering, search_start, search_limit, search_deadline
+ *
+ * @param ponder The ponder search, from startPonder()
+ * @param move The move the opponent played
+ * @return true if the move was expected, and ponder->result holds our reply
+ */
+bool finishPonder(ponderstate * ponder, char move[6])
+{
+    bool hit = memcmp(move, ponder->move, 4) == 0
+            && (ponder->move[4] == '\0' || move[4] == ponder->move[4]);
+
+    if (hit)
+    {
+        //Start the clock, if the search hasn't got to its setup yet it will
+        //  set the same clock itself
+        search_start = wallTime();
+        search_limit = ponder->tlimit;
+        search_deadline =
+                (ponder->tlimit > 0) ? search_start + ponder->tlimit : 0;
+        atomic_store(&search_pondering, false);
+    }
+    else
+    {
+        //Still pondering until it's joined, so that a search that hasn't
+        //  got to its setup yet doesn't clear the stop
+        stopSearch();
+    }
+
+    pthread_join(ponder->thread, NULL);
+    atomic_store(&search_pondering, false);
+
+    return (hit);
+}
+
+/*
+ * Runs the search for startPonder() on the background thread
+ *
+ * @param ponder The ponderstate of the search
+ * @return NULL
+ */
+void * ponderSearch(void * ponder)
+{
+    ponderstate * state = ponder;
+    selectBestMove(state->self_white, &state->position, &state->result,
+            state->tlimit, state->max_depth);
+    return (NULL);
+}
+
+/*
+ * Gets the current wall clock time
+ *
+ * @return The time in seconds since some fixed point
+ */
+double wallTime(void)
+{
+    struct timespec now;
+    timespec_get(&now, TIME_UTC);
+    return ((double) now.tv_sec + (double) now.tv_nsec / 1e9);
+}
+
+/*
+ * Converts a score from the search into the form it's kept in the
+ *  transposition table. Mate scores count from the root, so they're stored
+ *  counting from the node instead, to be right at any ply it's found at.
+ *
+ * @owner Js
+ *
+ * @param score The score of the node
+ * @param ply The distance of the node from the root
+ * @return The score to store
+ */
+int scoreToTransTable(int score, uint8_t ply)
+{
+    if (score > MATE_BOUND)
+    {
+        return (score + ply);
+    }
+    if (score < -MATE_BOUND)
+    {
+        return (score - ply);
+    }
+    return (score);
+}
+
+/*
+ * Converts a score read from the transposition table back into a score for
+ *  the search, undoing scoreToTransTable()
+ *
+ * @owner Js
+ *
+ * @param score The stored score
+ * @param ply The distance of the node from the root
+ * @return The score of the node
+ */
+int scoreFromTransTable(int score, uint8_t ply)
+{
+    if (score > MATE_BOUND)
+    {
+        return (score - ply);
+    }
+    if (score < -MATE_BOUND)
+    {
+        return (score + ply);
+    }
+    return (score);
+}
+
+/*
+ * Performs a negamax search, using principal variation search. The first
+ *  child is searched with the full window and the rest with null windows,
+ *  which are only re-searched if they beat alpha. Nodes at the horizon are
+ *  scored by quiesce().
+ *
+ * If enabled in search_options, a node that looks like it will fail high
+ *  first lets the opponent move twice at reduced depth (null move pruning),
+ *  and late quiet moves are searched a ply shallower unless they beat alpha
+ *  (late move reductions).
+ *
+ * The callee is responsible for doing the first expansion & call to negamax
+ *  for each root node, as well as determining which root node to use.
+ *
+ * @owner Js
+ *
+ * @uses search_options
+ *
+ * @param state A pointer to the start state for the layer. Moves are made
+ *              and unmade on it in place, so it's unchanged on return
+ * @param white If the current layer of the search is from white or black's
+ *          perspective
+ * @param alpha Best value seen
+ * @param beta The cutoff, should initially be INT_MAX - 1, NOT INT_MAX
+ * @param depth The depth to traverse to
+ * @param ply The distance of the node from the root
+ * @param split The innermost split point the node is being searched under,
+ *              NULL if none
+ *
+ * @return The best score resulting from the negamax search, or 0 if the
+ *         search was stopped
+ */
+int negamax(chessboard * const state, bool white, int alpha, int beta,
+        uint8_t depth, uint8_t ply, splitpoint * split)
+{
+    //Counters of the thread running the node
+#ifdef PARALLEL_NEGAMAX
+    searchstats * stats = &search_stats[omp_get_thread_num()];
+#else
+    searchstats * stats = search_stats;
+#endif
+
+    if (!depth)
+    {
+        //At the horizon, play out the captures before evaluating
+        return (quiesce(state, white, alpha, beta, QUIESCE_MAX_PLY, ply));
+    }
+    else
+    {
+        //best score at this height
+        int best = INT_MIN;
+        //Currently seen value
+        int cur;
+        //alpha on entry, to tell what kind of bound best is
+        int alpha_orig = alpha;
+        //Move that produced best, and the best move from a previous search
+        chessmove best_move = NO_MOVE;
+        chessmove hash_move = NO_MOVE;
+        //Which move failed high, if one did outside of a split point
+        uint8_t cutoff_index = UINT8_MAX;
+        //Moves of the node, and what's needed to take the current one back
+        movepicker picker;
+        chessmove mv;
+        undoinfo undo;
+        //Key of the position with the side to move
+        hashkey key = (white) ? state->key : state->key ^ side_key;
+        ttentry entry;
+        //Move ordering tables of the thread running the node
+#ifdef PARALLEL_NEGAMAX
+        heuristics * ordering = &search_heuristics[omp_get_thread_num()];
+#else
+        heuristics * ordering = search_heuristics;
+#endif
+
+        assert(state->key == hashBoard(state));
+
+        ++stats->nodes;
+
+        //Check the clock, but not right above the leaves where it would be
+        //  read for nearly every node
+        if (search_deadline && depth > 1
+                && !atomic_load_explicit(&search_pondering,
+                        memory_order_relaxed)
+                && wallTime() >= search_deadline)
+        {
+            atomic_store(&search_stop, true);
+        }
+        if (atomic_load_explicit(&search_stop, memory_order_relaxed)
+                || splitStopped(split))
+        {
+            return (0);
+        }
+
+        //See if this position has already been searched deeply enough
+        ++stats->tt_probes;
+        if (probeTransTable(key, &entry))
+        {
+            ++stats->tt_hits;
+            hash_move = entry.best;
+            cur = scoreFromTransTable(entry.score, ply);
+            if (entry.depth >= depth
+                    && ((entry.bound == TT_EXACT)
+                            || (entry.bound == TT_LOWER && cur >= beta)
+                            || (entry.bound == TT_UPPER && cur <= alpha)))
+            {
+                return (cur);
+            }
+        }
+
+        //Kings and pawns alone are often in zugzwang, where passing would
+        //  be better than any move, so don't try null moves with them
+        bool has_pieces = (((white) ? state->all_w_pieces
+                : state->all_b_pieces)
+                & ~(state->pieces[W_P] | state->pieces[W_K])) != 0;
+
+        //Moves are generated a stage at a time, best first
+        initMovePicker(&picker, state, white, hash_move, ordering, ply, false);
+
+        //Null move, if passing still fails high then a real move will too
+        //  The static score must already beat beta, which also stops the
+        //  opponent from passing straight back. Passing out of check would
+        //  let the king be taken
+        if (search_options.null_move && has_pieces && alpha + 1 == beta
+                && !picker.checks.checkers
+                && depth > search_options.null_move_reduction
+                && evaluateState(state, white) >= beta)
+        {
+            cur = -negamax(state, !white, -beta, -beta + 1,
+                    depth - 1 - search_options.null_move_reduction, ply + 1,
+                    split);
+
+            if (atomic_load_explicit(&search_stop, memory_order_relaxed)
+                    || splitStopped(split))
+            {
+                return (0);
+            }
+            if (cur >= beta)
+            {
+                return (cur);
+            }
+        }
+
+        //recurse negamax for each move
+        for (uint8_t i = 0; (mv = nextMove(&picker)) != NO_MOVE; ++i)
+        {
+#ifdef PARALLEL_NEGAMAX
+            //Young brothers wait, once the eldest has been searched without
+            //  a cutoff the rest can be searched in parallel
+            if (i == 1 && search_split && depth >= SPLIT_MIN_DEPTH)
+            {
+                //All of the rest are handed out at once
+                chessmove moves[MAX_MOVES];
+                uint8_t count = 0;
+                do
+                {
+                    moves[count++] = mv;
+                } while ((mv = nextMove(&picker)) != NO_MOVE);
+
+                best = splitSearch(state, white, moves, count, alpha, beta,
+                        depth, ply, best, &best_move, split);
+                break;
+            }
+#endif
+            doMove(state, mv, white, &undo);
+
+            if (i == 0)
+            {
+                //Principal variation, needs a real score
+                cur = -negamax(state, !white, -beta, -alpha, depth - 1,
+                        ply + 1, split);
+            }
+            else
+            {
+                cur = alpha + 1;
+
+                //Late quiet moves are unlikely to be good, so try them a ply
+                //  shallower first
+                if (search_options.late_move_reductions
+                        && i >= search_options.lmr_full_moves
+                        && depth >= search_options.lmr_min_depth
+                        && !(MOVE_FLAGS(mv) & (MOVE_CAPTURE | MOVE_PROMOTION)))
+                {
+                    cur = -negamax(state, !white, -alpha - 1, -alpha,
+                            depth - 2, ply + 1, split);
+                }
+
+                if (cur > alpha)
+                {
+                    //Null window, only need to prove this doesn't beat alpha
+                    cur = -negamax(state, !white, -alpha - 1, -alpha,
+                            depth - 1, ply + 1, split);
+                }
+                if (cur > alpha && cur < beta)
+                {
+                    //It does, so get its real score
+                    cur = -negamax(state, !white, -beta, -alpha, depth - 1,
+                            ply + 1, split);
+                }
+            }
+
+            undoMove(state, mv, white, &undo);
+
+            if (cur > best)
+            {
+                //Found a better value
+                best = cur;
+                best_move = mv;
+                if (cur >= beta)
+                {
+                    // fail-soft beta cutoff
+                    //  Beta is the the best value that the calling node has
+                    //  seen, so if we return a value that is better for us
+                    //  than the calling node, then the calling node will go
+                    //  ahead and select the other value anyways.
+                    cutoff_index = i;
+                    break;
+                }
+                if (cur > alpha)
+                {
+                    //Best score for level & better than alpha
+                    alpha = cur;
+                }
+            }
+        }
+
+        //Scores from a stopped search are meaningless, don't keep them
+        if (atomic_load_explicit(&search_stop, memory_order_relaxed)
+                || splitStopped(split))
+        {
+            return (0);
+        }
+
+        //No legal moves, so it's checkmate or stalemate
+        if (best == INT_MIN)
+        {
+            ++stats->leaves;
+            return ((picker.checks.checkers) ? -MATE_SCORE + ply : 0);
+        }
+
+        //Remember quiet moves that cause cutoffs, for move ordering
+        if (best >= beta)
+        {
+            updateHeuristics(ordering, state, white, best_move, depth, ply);
+
+            ++stats->cutoffs;
+            if (cutoff_index == 0)
+            {
+                ++stats->first_cutoffs;
+            }
+        }
+
+        //Remember the result for transpositions & later searches
+        storeTransTable(key, depth,
+                (best >= beta) ? TT_LOWER :
+                (best > alpha_orig) ? TT_EXACT : TT_UPPER,
+                scoreToTransTable(best, ply), best_move);
+
+        //Return the best value
+        return (best);
     }
 }
+
+/*
+ * Searches only captures & promotions from a node at the horizon, until the
+ *  position is quiet enough to evaluate. The side to move can always stand
+ *  pat on its static evaluation instead of capturing, unless it's in check,
+ *  where every evasion is searched instead.
+ *
+ * @owner Js
+ *
+ * @uses piece_vals
+ *
+ * @param state A pointer to the node
+ * @param white If the node is from white or black's perspective
+ * @param alpha Best value seen
+ * @param beta The cutoff
+ * @param qdepth How many more captures deep to search, at most
+ *               QUIESCE_MAX_PLY
+ * @param ply The distance of the node from the root
+ *
+ * @return The best score of the node, or 0 if the search was stopped
+ */
+int quiesce(chessboard * const state, bool white, int alpha, int beta,
+        uint8_t qdepth, uint8_t ply)
+{
+#ifdef PARALLEL_NEGAMAX
+    searchstats * stats = &search_stats[omp_get_thread_num()];
+#else
+    searchstats * stats = search_stats;
+#endif
+    ++stats->nodes;
+    ++stats->leaves;
+
+    //Score if no capture is made
+    int stand_pat = evaluateState(state, white);
+    bool in_check = inCheck(state, white);
+
+    if (!qdepth || (!in_check && stand_pat >= beta))
+    {
+        return (stand_pat);
+    }
+
+    //Delta pruning, not even winning a queen would bring it up to alpha
+    if (!in_check && stand_pat + piece_vals[W_Q] + DELTA_MARGIN < alpha)
+    {
+        return (stand_pat);
+    }
+
+    if (atomic_load_explicit(&search_stop, memory_order_relaxed))
+    {
+        return (0);
+    }
+
+    if (!in_check && stand_pat > alpha)
+    {
+        alpha = stand_pat;
+    }
+
+    //In check with no evasions is mate
+    int best = (in_check) ? -MATE_SCORE + ply : stand_pat;
+    int cur;
+    movepicker picker;
+    chessmove mv;
+    undoinfo undo;
+#ifdef PARALLEL_NEGAMAX
+    heuristics * ordering = &search_heuristics[omp_get_thread_num()];
+#else
+    heuristics * ordering = search_heuristics;
+#endif
+
+    //Captures in MVV/LVA order, or every evasion when in check
+    initMovePicker(&picker, state, white, NO_MOVE, ordering, ply, !in_check);
+
+    while ((mv = nextMove(&picker)) != NO_MOVE)
+    {
+        //Delta pruning per capture, promotions are always searched
+        if (!in_check && MOVE_FLAGS(mv) == MOVE_CAPTURE
+                && stand_pat + piece_vals[PIECE_AT(state, MOVE_TO(mv))]
+                        + DELTA_MARGIN < alpha)
+        {
+            continue;
+        }
+
+        doMove(state, mv, white, &undo);
+        cur = -quiesce(state, !white, -beta, -alpha, qdepth - 1, ply + 1);
+        undoMove(state, mv, white, &undo);
+
+        if (cur > best)
+        {
+            best = cur;
+            if (cur >= beta)
+            {
+                break;
+            }
+            if (cur > alpha)
+            {
+                alpha = cur;
+            }
+        }
+    }
+
+    return (best);
+}
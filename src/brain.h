@@ -12,49 +12,615 @@
 
 #include <inttypes.h>
 #include <limits.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <time.h>
 
 #include "common_defs.h"
 #include "board.h"
+#include "ttable.h"
+
+//Ways of dividing the search between threads under PARALLEL_NEGAMAX
+//Each iteration's root moves are shared out between the threads
+#define PARALLEL_ROOT_SPLIT 0
+//Every thread searches the whole tree at staggered depths, sharing results
+//  through the transposition table
+#define PARALLEL_LAZY_SMP 1
+//Young brothers wait, nodes split their children between threads once the
+//  first child has been searched
+#define PARALLEL_YBWC 2
+
+//Shallowest node PARALLEL_YBWC will split, shallower subtrees are too small
+//  to be worth handing to another thread
+#define SPLIT_MIN_DEPTH 4
+
+//Half width of the root window around the last iteration's score, half a
+//  pawn either way
+#define ASPIRATION_WINDOW 50
+
+//Score of being checkmated at the root, nearer mates are worth more so a
+//  node mated ply moves from the root scores -MATE_SCORE + ply
+#define MATE_SCORE 30000
+//Scores further from 0 than this are mates, no node is 256 plies deep
+#define MATE_BOUND (MATE_SCORE - 256)
+
+//Most captures the quiescence search will play out past the horizon
+#define QUIESCE_MAX_PLY 8
+//Delta pruning margin, captures that can't bring the score to within this
+//  of alpha aren't searched
+#define DELTA_MARGIN 200
+
+//Stages of a movepicker, in the order moves are handed out
+//Best move from the transposition table
+#define STAGE_HASH 0
+//Captures & promotions by most valuable victim/least valuable attacker
+#define STAGE_GEN_CAPTURES 1
+#define STAGE_CAPTURES 2
+//Quiet moves that caused a cutoff at the same ply, newest first
+#define STAGE_KILLERS 3
+//Everything else, the countermove then by history score
+#define STAGE_GEN_QUIETS 4
+#define STAGE_QUIETS 5
+#define STAGE_DONE 6
+
+//Quiet move ordering scores, see scoreMoves()
+//Quiet move that last refuted the opponent's move
+#define COUNTER_SCORE 8000
+//History scores are halved when one reaches this, to keep them below the
+//  countermove
+#define HISTORY_MAX 8000
+
+//Deepest ply that has killer moves kept for it
+#define MAX_PLY 64
+
+//Root states kept for each search thread, MAX_MOVES rounded up to a
+//  multiple of 8, since 8 boards are a whole number of cache lines
+#define ROOT_STATES ((MAX_MOVES + 7) & ~7)
+
+/*
+ * Runtime options for the search
+ */
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wpadded"
+typedef struct
+{
+    //Number of threads to search with, 0 to pick automatically
+    //  Only used with PARALLEL_NEGAMAX
+    int threads;
+    //One of the PARALLEL_* modes, only used with PARALLEL_NEGAMAX
+    uint8_t parallel_mode;
+    //Null move pruning, and how many plies the null move search is reduced
+    bool null_move;
+    uint8_t null_move_reduction;
+    //Late move reductions, how many moves of a node are searched at full
+    //  depth first, and the shallowest depth reduced, at least 2
+    bool late_move_reductions;
+    uint8_t lmr_full_moves;
+    uint8_t lmr_min_depth;
+    //Search on the opponent's time while waiting for their move
+    bool ponder;
+} searchoptions;
+#pragma clang diagnostic pop
+
+extern searchoptions search_options;
+
+/*
+ * Move ordering tables for quiet moves, filled in from beta cutoffs by
+ *  updateHeuristics(). Each search thread has its own.
+ */
+typedef struct
+{
+    //Two most recent quiet moves that caused a cutoff, for each ply
+    chessmove killers[MAX_PLY][2];
+    //Cutoff scores for each side, indexed by [from][to]
+    uint32_t history[2][64][64];
+    //Quiet move that refuted the opponent's last move, indexed by the
+    //  opponent's [piece code][to]
+    chessmove countermoves[12][64];
+} heuristics;
+
+/*
+ * Hands out a node's moves best first, a stage at a time, see nextMove().
+ *  Each stage's moves are only generated once the stages before it have
+ *  run out, so a node that fails high early never generates the rest.
+ */
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wpadded"
+typedef struct
+{
+    //Moves of the current stage, and their ordering scores
+    chessmove moves[MAX_MOVES];
+    int scores[MAX_MOVES];
+    //Number of moves in the stage, and the next one to hand out
+    uint8_t count;
+    uint8_t next;
+    //Which STAGE_* is being handed out
+    uint8_t stage;
+    //Only hand out captures & promotions
+    bool captures_only;
+
+    //The node the moves are from
+    chessboard * board;
+    bool white;
+    uint8_t ply;
+    heuristics * ordering;
+    //The checks and pins against the side to move
+    checkinfo checks;
+
+    //Moves handed out in their own stage, skipped in the generated ones
+    chessmove hash_move;
+    chessmove killers[2];
+} movepicker;
+#pragma clang diagnostic pop
+
+/*
+ * Counters for a search, see printStats(). Each search thread has its own,
+ *  aligned to a cache line so that threads never write to the same line.
+ */
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wpadded"
+typedef struct
+{
+    //Nodes visited by negamax & quiesce
+    _Alignas(64) uint64_t nodes;
+    //Nodes scored by evaluateState()
+    uint64_t leaves;
+    //Nodes that failed high, and those that did on their first move
+    uint64_t cutoffs;
+    uint64_t first_cutoffs;
+    //Transposition table lookups, and those that found the position
+    uint64_t tt_probes;
+    uint64_t tt_hits;
+    //Only kept by the main thread, the number of completed iterations, and
+    //  the time since the start & node count at the end of each
+    uint8_t iterations;
+    double iteration_time[MAX_PLY];
+    uint64_t iteration_nodes[MAX_PLY];
+} searchstats;
+#pragma clang diagnostic pop
+
+/*
+ * A search running on the opponent's time, see startPonder()
+ */
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wpadded"
+typedef struct
+{
+    //Thread running the search
+    pthread_t thread;
+    //true if we are white
+    bool self_white;
+    //Board after the reply we expect, and our best move from it
+    chessboard position;
+    chessboard result;
+    //The reply we expect, as a movestring
+    char move[6];
+    //Time limit once the reply is played, and the deepest iteration
+    double tlimit;
+    uint8_t max_depth;
+} ponderstate;
+#pragma clang diagnostic pop
+
+/*
+ * A node whose children are being searched in parallel, see splitSearch()
+ */
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wpadded"
+typedef struct splitpoint
+{
+    //Set when a child fails high, to call off the other children
+    atomic_bool stop;
+    //Best score seen by the children so far, used as their alpha
+    atomic_int alpha;
+    //The split point this one is under, NULL if none
+    struct splitpoint * parent;
+    //Best score & move of the node so far, updated in a critical section
+    int best;
+    chessmove best_move;
+} splitpoint;
+#pragma clang diagnostic pop
 
 /*
  * Does a search for and returns the best move for the board
  *
+ * Searches with iterative deepening, depth 1, 2, 3... until either max_depth
+ *  has been searched or the time limit runs out. The move returned is the
+ *  best move of the last iteration that completed.
+ *
  * @owner Js
  *
+ * @uses search_options
+ *
  * @param self_white true if we are white
  * @param initial A pointer to the initial board state to use
  * @param result A pointer that will be filled with the new board state based
- *               on the function's selected best move. last_piece and last_move
- *               will be set to the value of the piece & location to move it to
- * @param tlimit The amount of time left on the clock in seconds
+ *               on the function's selected best move. last_from and last_move
+ *               will be set to the locations to move the piece from & to
+ * @param tlimit The amount of time to spend on the search in seconds, 0 for
+ *               no limit
+ * @param max_depth The deepest iteration to search
+ * @return The score of the selected move
+ */
+int selectBestMove(bool self_white, chessboard * restrict const initial,
+        chessboard * restrict result, double tlimit, uint8_t max_depth);
+
+/*
+ * Works out how many threads a search runs on, search_options.threads if
+ *  it was given, otherwise as many as OpenMP offers with USE_MAX_THREADS or
+ *  4 without. Always 1 without PARALLEL_NEGAMAX.
+ *
+ * @owner Js
+ *
+ * @uses search_options
+ *
+ * @return The number of search threads
+ */
+int searchThreads(void);
+
+/*
+ * Allocates the storage every search reuses, for searchThreads() threads.
+ *  Any existing storage is freed first. Each thread's tables & root states
+ *  start on their own cache line, so no search allocates while it runs.
+ *
+ * @owner Js
+ *
+ * @modifies search_heuristics, search_stats, search_roots,
+ *           search_arena_threads
+ *
+ * @return true if the storage was allocated
+ */
+bool initSearchArenas(void);
+
+/*
+ * Frees the storage allocated by initSearchArenas()
+ *
+ * @owner Js
+ *
+ * @modifies search_heuristics, search_stats, search_roots,
+ *           search_arena_threads
+ */
+void freeSearchArenas(void);
+
+/*
+ * Runs an iterative deepening search over a set of root states on the
+ *  calling thread, until max_depth has been searched or the search is
+ *  stopped.
+ *
+ * Thread 0 is the main thread, and is the only one that manages the clock.
+ *  Odd numbered helper threads search a ply ahead of the others so that
+ *  Lazy SMP threads are spread over two depths.
+ *
+ * Each iteration starts with an aspiration window around the score of the
+ *  last, and is searched again with a wider window if it falls outside.
+ *
+ * @owner Js
+ *
+ * @param self_white true if we are white
+ * @param roots The expanded root states. These are reordered so that the
+ *              best move of each iteration is searched first in the next
+ * @param states The number of root states
+ * @param max_depth The deepest iteration to search
+ * @param thread The number of the calling thread
+ * @param best_indx Filled with the index into roots of the best move of the
+ *                  last completed iteration
+ * @return The score of the best move of the last completed iteration
+ */
+int iterativeDeepening(bool self_white, boardset * roots, uint8_t states,
+        uint8_t max_depth, int thread, uint8_t * best_indx);
+
+/*
+ * Searches a set of root states to a depth with principal variation search
+ *
+ * @owner Js
+ *
+ * @param self_white true if we are white
+ * @param roots The expanded root states
+ * @param states The number of root states
+ * @param alpha Lower bound of the window
+ * @param beta Upper bound of the window
+ * @param depth The depth to search to
+ * @param best_indx Filled with the index into roots of the best move
+ * @return The score of the best move, a bound if outside alpha..beta
+ */
+int searchRoot(bool self_white, boardset * roots, uint8_t states,
+        int alpha, int beta, uint8_t depth, uint8_t * best_indx);
+
+#ifdef PARALLEL_NEGAMAX
+/*
+ * Runs an iterative deepening search, splitting the root moves of each
+ *  iteration between threads. Moves are handed out one at a time in order,
+ *  and every thread searches with the best score found by any thread so far
+ *  as its alpha.
+ *
+ * @owner Js
+ *
+ * @param self_white true if we are white
+ * @param roots The expanded root states. These are reordered by score after
+ *              each iteration so that the next searches the best first
+ * @param states The number of root states
+ * @param max_depth The deepest iteration to search
+ * @param threadcount The number of threads to search with
+ * @param best_indx Filled with the index into roots of the best move of the
+ *                  last completed iteration
+ * @return The score of the best move of the last completed iteration
+ */
+int rootSplitSearch(bool self_white, boardset * roots, uint8_t states,
+        uint8_t max_depth, int threadcount, uint8_t * best_indx);
+
+/*
+ * Searches the remaining moves of a node in parallel once its first move
+ *  has been searched. Each move becomes a task that idle threads can pick
+ *  up, on their own copy of the node, and a move that fails high stops its
+ *  siblings.
+ *
+ * @owner Js
+ *
+ * @param state The node being split
+ * @param white If the node is from white or black's perspective
+ * @param moves The moves of the node left to search, after the first, in
+ *              the order to search them
+ * @param count The number of moves
+ * @param alpha Best value seen
+ * @param beta The cutoff
+ * @param depth The depth of the node
+ * @param ply The distance of the node from the root
+ * @param best The score of the first move
+ * @param best_move The first move, filled with the best move
+ * @param parent The innermost split point the node is under, NULL if none
+ * @return The best score of the node
+ */
+int splitSearch(chessboard * const state, bool white, chessmove moves[],
+        uint8_t count, int alpha, int beta, uint8_t depth, uint8_t ply,
+        int best, chessmove * best_move, splitpoint * parent);
+#endif
+
+/*
+ * Sets up a movepicker for a node. Nothing is generated until nextMove()
+ *  needs it, other than the checks against the side to move.
+ *
+ * @owner Js
+ *
+ * @param picker The picker to set up
+ * @param board The node the moves are from, which must not change while
+ *              the picker is in use, other than moves being made and unmade
+ * @param white true if the moves are white's
+ * @param hash_move The best move from the transposition table, or NO_MOVE
+ * @param ordering The move ordering tables of the thread
+ * @param ply The distance of board from the root
+ * @param captures_only true to only hand out captures & promotions
+ */
+void initMovePicker(movepicker * picker, chessboard * const board, bool white,
+        chessmove hash_move, heuristics * ordering, uint8_t ply,
+        bool captures_only);
+
+/*
+ * Hands out a node's next move. The move from the transposition table goes
+ *  first, then captures & promotions by most valuable victim/least valuable
+ *  attacker, then the killer moves, then the countermove, then everything
+ *  else by history score. The hash move and killers are checked against the
+ *  board before being handed out, since they come from other nodes.
+ *
+ * @owner Js
+ *
+ * @param picker The picker of the node
+ * @return The next move, or NO_MOVE once all of them have been handed out
+ */
+chessmove nextMove(movepicker * picker);
+
+/*
+ * Gives the moves of the picker's current stage their ordering scores
+ *
+ * @owner Js
+ *
+ * @uses mvv_lva_ranks, promotion_codes
+ *
+ * @param picker The picker with a newly generated stage
+ */
+void scoreMoves(movepicker * picker);
+
+/*
+ * Takes the best scored move left in the picker's current stage, a
+ *  selection sort one move at a time, since the rest often aren't needed
+ *
+ * @owner Js
+ *
+ * @param picker The picker of the node
+ * @return The move, or NO_MOVE if the stage has run out
+ */
+chessmove pickMove(movepicker * picker);
+
+/*
+ * Records a move that caused a beta cutoff in the move ordering tables.
+ *  Captures & promotions are already ordered well, so only quiet moves are
+ *  recorded.
+ *
+ * @owner Js
+ *
+ * @param ordering The move ordering tables of the thread
+ * @param board The node that failed high
+ * @param white true if it's white's move at board
+ * @param mv The move that caused the cutoff
+ * @param depth The depth of board
+ * @param ply The distance of board from the root
+ */
+void updateHeuristics(heuristics * ordering, chessboard * const board,
+        bool white, chessmove mv, uint8_t depth, uint8_t ply);
+
+/*
+ * Records the end of an iteration in the main thread's counters
+ *
+ * @param stats The counters of the main thread
+ * @param elapsed The time since the search started
+ */
+void recordIteration(searchstats * stats, double elapsed);
+
+/*
+ * Adds up the counters of all of the search threads
+ *
+ * @param stats The counters of each thread, the first being the main thread
+ * @param threadcount The number of threads
+ * @param out Filled with the totals, and the iterations of the main thread
+ */
+void mergeStats(searchstats * stats, int threadcount, searchstats * out);
+
+/*
+ * Prints the counters of a search as a single line of key=value pairs,
+ *  prefixed with "stats". The effective branching factor is the ratio of
+ *  the nodes in the last two iterations, as seen by the main thread, and
+ *  the iteration times are the time each iteration took.
+ *
+ * @param stats The merged counters of the search
+ * @param elapsed The time the search took
+ */
+void printStats(searchstats * stats, double elapsed);
+
+/*
+ * Checks if a split point, or any split point above it, has been stopped
+ *
+ * @param split The split point to check, NULL is never stopped
+ * @return true if the search under split should be abandoned
+ */
+bool splitStopped(splitpoint * split);
+
+/*
+ * Stops any running search. The search will return the best move from its
+ *  last completed iteration.
+ *
+ * @modifies search_stop
+ */
+void stopSearch(void);
+
+/*
+ * Starts searching on the opponent's time. The opponent's reply is guessed
+ *  from the transposition table, and our reply to it is searched on a
+ *  background thread until finishPonder() is called.
+ *
+ * @owner Js
+ *
+ * @modifies search_pondering, search_stop
+ *
+ * @param ponder Filled with the state of the ponder search
+ * @param self_white true if we are white
+ * @param board The board after our move, with the opponent to move
+ * @param tlimit The time limit of our search once the opponent has moved
+ * @param max_depth The deepest iteration to search
+ * @return true if a ponder search was started, false if there was no reply
+ *         to expect
  */
-void selectBestMove(bool self_white, chessboard * restrict const initial,
-        chessboard * restrict result, uint8_t depth);
+bool startPonder(ponderstate * ponder, bool self_white,
+        chessboard * const board, double tlimit, uint8_t max_depth);
 
 /*
- * Performs a standard negamax search
+ * Ends a ponder search once the opponent has moved. If they played the
+ *  expected move the ponder search carries on as our search, with the full
+ *  time limit from now. Otherwise it's stopped, but whatever it stored in
+ *  the transposition table is kept.
+ *
+ * @owner Js
+ *
+ * @modifies search_pondering, search_start, search_limit, search_deadline
+ *
+ * @param ponder The ponder search, from startPonder()
+ * @param move The move the opponent played
+ * @return true if the move was expected, and ponder->result holds our reply
+ */
+bool finishPonder(ponderstate * ponder, char move[6]);
+
+/*
+ * Runs the search for startPonder() on the background thread
+ *
+ * @param ponder The ponderstate of the search
+ * @return NULL
+ */
+void * ponderSearch(void * ponder);
+
+/*
+ * Gets the current wall clock time
+ *
+ * @return The time in seconds since some fixed point
+ */
+double wallTime(void);
+
+/*
+ * Converts a score from the search into the form it's kept in the
+ *  transposition table. Mate scores count from the root, so they're stored
+ *  counting from the node instead, to be right at any ply it's found at.
+ *
+ * @owner Js
+ *
+ * @param score The score of the node
+ * @param ply The distance of the node from the root
+ * @return The score to store
+ */
+int scoreToTransTable(int score, uint8_t ply);
+
+/*
+ * Converts a score read from the transposition table back into a score for
+ *  the search, undoing scoreToTransTable()
+ *
+ * @owner Js
+ *
+ * @param score The stored score
+ * @param ply The distance of the node from the root
+ * @return The score of the node
+ */
+int scoreFromTransTable(int score, uint8_t ply);
+
+/*
+ * Performs a negamax search, using principal variation search. The first
+ *  child is searched with the full window and the rest with null windows,
+ *  which are only re-searched if they beat alpha. Nodes at the horizon are
+ *  scored by quiesce().
+ *
+ * If enabled in search_options, a node that looks like it will fail high
+ *  first lets the opponent move twice at reduced depth (null move pruning),
+ *  and late quiet moves are searched a ply shallower unless they beat alpha
+ *  (late move reductions).
  *
  * The callee is responsible for doing the first expansion & call to negamax
  *  for each root node, as well as determining which root node to use.
  *
  * @owner Js
  *
- * @param state A pointer to the start state for the layer
+ * @uses search_options
+ *
+ * @param state A pointer to the start state for the layer. Moves are made
+ *              and unmade on it in place, so it's unchanged on return
  * @param white If the current layer of the search is from white or black's
  *          perspective
- * @param expansionStore An array of chessboard * to use for storing expanded
- *                       states. These may be realloc'd during execution of
- *                       the search.
- *                       !!! It is assumed to contain at least as many
- *                       pointers as the maximum depth of the search. Supplying
- *                       less will result in out of bounds memory access. !!!
- * @param alpha Best value seen, should initially be INT_MIN + 1, not INT_MIN
- * @param beta The cutoff
+ * @param alpha Best value seen
+ * @param beta The cutoff, should initially be INT_MAX - 1, NOT INT_MAX
  * @param depth The depth to traverse to
+ * @param ply The distance of the node from the root
+ * @param split The innermost split point the node is being searched under,
+ *              NULL if none
+ *
+ * @return The best score resulting from the negamax search, or 0 if the
+ *         search was stopped
+ */
+int negamax(chessboard * const state, bool white, int alpha, int beta,
+        uint8_t depth, uint8_t ply, splitpoint * split);
+
+/*
+ * Searches only captures & promotions from a node at the horizon, until the
+ *  position is quiet enough to evaluate. The side to move can always stand
+ *  pat on its static evaluation instead of capturing.
+ *
+ * @owner Js
+ *
+ * @uses piece_vals
+ *
+ * @param state A pointer to the node
+ * @param white If the node is from white or black's perspective
+ * @param alpha Best value seen
+ * @param beta The cutoff
+ * @param qdepth How many more captures deep to search, at most
+ *               QUIESCE_MAX_PLY
+ * @param ply The distance of the node from the root
  *
- * @return The best score resulting from the negamax search
+ * @return The best score of the node, or 0 if the search was stopped
  */
-int negamax(chessboard * const state, bool white, boardset * expansionStore,
-        int alpha, int beta, uint8_t depth);
+int quiesce(chessboard * const state, bool white, int alpha, int beta,
+        uint8_t qdepth, uint8_t ply);
 
 #endif /* BRAIN_H_ */
@@ -15,6 +15,10 @@
 #define INVALID_SQUARE ((uint8_t) 64)
 #define CAPTURED INVALID_SQUARE
 
+//Bits of the index into the magic attack tables for each square
+#define ROOK_INDEX_BITS 12
+#define BISHOP_INDEX_BITS 9
+
 /*
  * This is a bitmap of the board, used to represent various boolean predicates
  * examples:
@@ -24,4 +28,9 @@
  */
 typedef uint64_t bitboard;
 
+/*
+ * A Zobrist hash of a board state, used to index the transposition table
+ */
+typedef uint64_t hashkey;
+
 #endif /* COMMON_DEFS_H_ */
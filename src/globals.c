@@ -49,6 +49,30 @@ uint8_t legal_moves[12][64][8][7];
  */
 bitboard attacked_squares[12][64];
 
+/*
+ * Magic bitboard tables for the sliding pieces. The mask of a square is the
+ * set of squares whose occupancy can block a slider on it, the board's edges
+ * never block anything so they aren't included. Multiplying the occupied
+ * squares of the mask by the square's magic gathers them into the top bits,
+ * which index the attacks for that occupancy. Queens use both.
+ *
+ * rook_attacks[position][((occupied & rook_masks[position])
+ *      * rook_magics[position]) >> (64 - ROOK_INDEX_BITS)]
+ *
+ * @users board
+ * @modifiers pregame
+ *
+ * @initializer pregame->generateMoveTables. These are saved with the other
+ *              tables.
+ * @initializer pregame->loadMoveTables.
+ */
+bitboard rook_masks[64];
+bitboard bishop_masks[64];
+uint64_t rook_magics[64];
+uint64_t bishop_magics[64];
+bitboard rook_attacks[64][1 << ROOK_INDEX_BITS];
+bitboard bishop_attacks[64][1 << BISHOP_INDEX_BITS];
+
 /*
  * Lookup table indicating the location bitboards for each square
  *
@@ -113,6 +137,37 @@ const char piece_chars[12] =
 const uint16_t piece_vals[12] =
 { 100, 500, 320, 330, 900, 20000, 100, 500, 320, 330, 900, 20000 };
 
+/*
+ * Relative value of each piece for ordering captures by most valuable
+ * victim/least valuable attacker. The king is highest, so capturing it is
+ * always tried first.
+ *
+ * @users brain
+ */
+//White/black, P, R, N, B, Q, K
+const uint8_t mvv_lva_ranks[12] =
+{ 1, 4, 2, 3, 5, 6, 1, 4, 2, 3, 5, 6 };
+
+/*
+ * How much each piece counts towards the game phase, the minor pieces 1, the
+ * rooks 2 and the queens 4, for PHASE_MAX in all at the start. Codes 12-15
+ * are 0, so an empty square (SQUARE_EMPTY) counts for nothing.
+ *
+ * @users board
+ */
+//White/black, P, R, N, B, Q, K
+const uint8_t phase_vals[16] =
+{ 0, 2, 1, 1, 4, 0, 0, 2, 1, 1, 4, 0, 0, 0, 0, 0 };
+
+/*
+ * White piece code for each promotion in a packed move, add 6 for black
+ *
+ * @users board, brain
+ */
+//N, B, R, Q
+const uint8_t promotion_codes[4] =
+{ 2, 3, 1, 4 };
+
 /*
  * Initial positions of white/black pieces
  * Pawns:   indexes 0-7 of white/black position arrays
@@ -132,21 +187,59 @@ const uint8_t black_initial[16] =
 { 48, 49, 50, 51, 52, 53, 54, 55, 56, 63, 57, 62, 58, 61, 59, 60 };
 
 /*
- * Stores the randomly generated N-bit keys for hash table key generation.
- * The resulting hash table will contain 2^N entries. This is indexed by piece
- * type and location.
+ * Castling rights kept when a move touches a square, either leaving it or
+ * landing on it. Moving the king loses both, moving or capturing a rook in
+ * its corner loses that side.
+ *
+ * @users board
+ */
+const uint8_t w_castle_masks[64] =
+{ 1, 3, 3, 3, 0, 3, 3, 2, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3,
+        3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3,
+        3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3 };
+const uint8_t b_castle_masks[64] =
+{ 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3,
+        3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3,
+        3, 3, 3, 3, 3, 3, 3, 3, 1, 3, 3, 3, 0, 3, 3, 2 };
+
+/*
+ * Stores the randomly generated 64-bit Zobrist keys for hash table key
+ * generation. This is indexed by piece type and location.
  *
  * These are loaded at program start, and not modified during runtime unless
  * game pre-generation work is being performed.
  *
- * @users board
+ * @users board, brain
  * @modifiers pregame
  *
  * @initializer pregame->generateHashkeys. Generates a new set of hashkeys
  *              prior to game start. Hashkeys are not currently saved, and
  *              must be regenerated during each startup.
  */
-//HASHKEY key_table[12][64];
+hashkey key_table[12][64];
+
+/*
+ * Zobrist keys for the castling rights of each side, indexed by
+ * [white/black][*_cancastle]
+ *
+ * @users board
+ * @modifiers pregame
+ *
+ * @initializer pregame->generateHashkeys
+ */
+hashkey castle_keys[2][4];
+
+/*
+ * Zobrist key toggled in when it is black's turn to move. The side to move is
+ * not stored on the board, so this is applied by the search when it probes
+ * the transposition table.
+ *
+ * @users brain
+ * @modifiers pregame
+ *
+ * @initializer pregame->generateHashkeys
+ */
+hashkey side_key;
 
 /*
  * Lookup tables for evalutation function based on the article here:
@@ -235,13 +328,26 @@ const int8_t b_K_e_positions[64] =
         -30, -30, 0, 0, 0, 0, -30, -30, -50, -30, -30, -30, -30, -30, -30, -50 };
 
 /*
- * The array of tables for easy lookup
- * @users board
- * @modifiers whatever function decides the difference between midgame/endgame
+ * The array of middlegame tables for easy lookup. The endgame uses the same
+ * tables but for the kings, see generateEvalTables().
+ *
+ * @users pregame
  */
-//TODO Modify this so king positions update to endgame state at right time
-const int8_t * board_position_vals[12] =
+const int8_t * const board_position_vals[12] =
 { w_P_positions, w_N_positions, w_B_positions, w_R_positions, w_Q_positions,
         w_K_m_positions, b_P_positions, b_N_positions, b_B_positions,
         b_R_positions, b_Q_positions, b_K_m_positions };
 
+/*
+ * The value of each piece on each square, its material plus its position,
+ * indexed by [middlegame/endgame][piece code][square]. Black's values are
+ * negative, so summing over the board gives white's score less black's.
+ * Codes 12-15 are all 0, so an empty square (SQUARE_EMPTY) adds nothing.
+ *
+ * @users board
+ * @modifiers pregame
+ *
+ * @initializer pregame->generateEvalTables
+ */
+int32_t piece_square_vals[2][16][64];
+
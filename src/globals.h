@@ -15,13 +15,24 @@
 //declare external
 extern uint8_t legal_moves[12][64][8][7];
 extern bitboard attacked_squares[12][64];
+extern bitboard rook_masks[64];
+extern bitboard bishop_masks[64];
+extern uint64_t rook_magics[64];
+extern uint64_t bishop_magics[64];
+extern bitboard rook_attacks[64][1 << ROOK_INDEX_BITS];
+extern bitboard bishop_attacks[64][1 << BISHOP_INDEX_BITS];
 extern const bitboard location_boards[65];
 extern const uint8_t w_codes[16];
 extern const uint8_t b_codes[16];
 extern const char piece_chars[12];
 extern const uint16_t piece_vals[12];
+extern const uint8_t mvv_lva_ranks[12];
+extern const uint8_t phase_vals[16];
+extern const uint8_t promotion_codes[4];
 extern const uint8_t white_initial[16];
 extern const uint8_t black_initial[16];
+extern const uint8_t w_castle_masks[64];
+extern const uint8_t b_castle_masks[64];
 extern const int8_t w_P_positions[64];
 extern const int8_t b_P_positions[64];
 extern const int8_t w_N_positions[64];
@@ -36,7 +47,10 @@ extern const int8_t w_K_m_positions[64];
 extern const int8_t b_K_m_positions[64];
 extern const int8_t w_K_e_positions[64];
 extern const int8_t b_K_e_positions[64];
-extern const int8_t * board_position_vals[12];
-//extern HASHKEY key_table[12][64];
+extern const int8_t * const board_position_vals[12];
+extern int32_t piece_square_vals[2][16][64];
+extern hashkey key_table[12][64];
+extern hashkey castle_keys[2][4];
+extern hashkey side_key;
 
 #endif /* GLOBALS_H_ */
@@ -7,21 +7,33 @@
  * 
  */
 #include <sys/time.h>
+#include <time.h>
 
 #include "board.h"
 #include "pregame.h"
 #include "brain.h"
+#include "perft.h"
 
-#define INITIAL_DEPTH 7
+//Seconds to spend searching each move
+#define DEFAULT_MOVE_TIME 10.0
+//Deepest iteration the search will go to if it has time
+#define MAX_DEPTH 64
 
 #ifdef PLAY_SELF
-void playSampleGame(uint8_t w_ply, uint8_t b_ply);
+void playSampleGame(uint8_t w_ply, uint8_t b_ply, double tlimit);
 #endif
 
 void getPlayerMove(char move[7]);
 
+int parseOptions(int argc, const char * argv[]);
+
+int runPerft(int argc, const char * argv[]);
+
 int main(int argc, const char * argv[])
 {
+    //Pull out the --options, leaving the positional arguments
+    argc = parseOptions(argc, argv);
+
     //Load or generate tables
     if (!loadMoveTables())
     {
@@ -29,6 +41,29 @@ int main(int argc, const char * argv[])
         generateMoveTables();
     }
 
+    //Keys must exist before any board is set up
+    generateHashkeys();
+    generateEvalTables();
+
+    //Count the move tree instead of playing
+    if (argc >= 3 && strcmp(argv[1], "perft") == 0)
+    {
+        return (runPerft(argc - 2, &argv[2]));
+    }
+
+    if (!initTransTable(TT_SIZE_MB))
+    {
+        puts("Unable to allocate the transposition table");
+        return (1);
+    }
+
+    //Everything the search needs is allocated up front
+    if (!initSearchArenas())
+    {
+        puts("Unable to allocate the search storage");
+        return (1);
+    }
+
     //Get a new board and initialize it
     chessboard current_state;
     chessboard next_state;
@@ -38,10 +73,11 @@ int main(int argc, const char * argv[])
 #ifdef PLAY_SELF
     if (argc < 3)
     {
-        puts("Usage: w_ply, b_ply");
+        puts("Usage: w_ply, b_ply [, seconds per move]");
         return (0);
     }
-    playSampleGame((uint8_t) atoi(argv[1]), (uint8_t) atoi(argv[2]));
+    playSampleGame((uint8_t) atoi(argv[1]), (uint8_t) atoi(argv[2]),
+            (argc >= 4) ? atof(argv[3]) : 0);
     return 0;
 
 #pragma clang diagnostic push
@@ -50,35 +86,69 @@ int main(int argc, const char * argv[])
 
     if (argc < 2)
     {
-        puts("Usage: <w|b> [<initial_depth>]");
+        puts("Usage: <w|b> [<seconds per move>] [<max depth>]"
+                " [--threads <n>] [--parallel <smp|root|ybwc>]"
+                " [--null-move <R|off>] [--lmr <moves|off>]"
+                " [--lmr-depth <n>] [--ponder]");
+        puts("       perft <depth> [divide] [<move>...]");
         return (0);
     }
 
-    uint8_t depth = (argc >= 3) ? (uint8_t) atoi(argv[2]) : INITIAL_DEPTH;
+    double tlimit = (argc >= 3) ? atof(argv[2]) : DEFAULT_MOVE_TIME;
+    uint8_t depth = (argc >= 4) ? (uint8_t) atoi(argv[3]) : MAX_DEPTH;
 
     bool self_white = (argv[1][0] == 'w') ? true : false;
 
     //The play they made/we made
     char move[7];
 
+    //Search on their time, and if they played the move it expected
+    ponderstate ponder;
+    bool pondering = false;
+    bool ponder_hit = false;
+
     if (self_white)
         goto WHITE_START;
 
     //Game loop
     while (true)
     {
+        //Think about our reply to the move we expect while they think
+        pondering = search_options.ponder
+                && startPonder(&ponder, self_white, &current_state, tlimit,
+                        depth);
+
         //Get their move
         getPlayerMove(move);
 
         printf("received move: %s\n", move);
 
+        //If it was expected, the ponder search carries on as our search
+        ponder_hit = pondering && finishPonder(&ponder, move);
+
         //Parse the move
         parseMoveString(move, !self_white, &current_state);
         printBoard(&current_state);
 
 WHITE_START:
+        //Nothing to search if they've mated or stalemated us
+        if (!hasLegalMoves(&current_state, self_white))
+        {
+            puts((inCheck(&current_state, self_white)) ? "Checkmate, you win"
+                    : "Stalemate");
+            break;
+        }
+
         //Make move
-        selectBestMove(self_white, &current_state, &next_state, depth);
+        if (ponder_hit)
+        {
+            next_state = ponder.result;
+        }
+        else
+        {
+            selectBestMove(self_white, &current_state, &next_state, tlimit,
+                    depth);
+        }
 
         //Extract the move
         getMoveString(&next_state, &current_state, self_white, move);
@@ -88,6 +158,13 @@ WHITE_START:
 
         //Update current state
         current_state = next_state;
+
+        if (!hasLegalMoves(&current_state, !self_white))
+        {
+            puts((inCheck(&current_state, !self_white)) ? "Checkmate, I win"
+                    : "Stalemate");
+            break;
+        }
     }
 
 #pragma clang diagnostic push
@@ -100,6 +177,171 @@ WHITE_START:
 #endif
 }
 
+/*
+ * Counts the move tree from the start position, or from after a list of
+ *  moves, and reports how fast it was generated. Under PARALLEL_NEGAMAX the
+ *  count is split between searchThreads() threads.
+ *
+ * @uses search_options
+ *
+ * @param argc The number of arguments after "perft"
+ * @param argv The depth, then optionally "divide" to count each move
+ *             separately, then the moves to play first, e.g. e2e4
+ * @return The exit code, 1 if one of the moves can't be played
+ */
+int runPerft(int argc, const char * argv[])
+{
+    chessboard board;
+    bool white = true;
+    uint8_t depth = (uint8_t) atoi(argv[0]);
+    bool divide = (argc >= 2 && strcmp(argv[1], "divide") == 0);
+
+    chessmove moves[MAX_MOVES];
+    checkinfo checks;
+    undoinfo undo;
+    uint8_t count, k;
+    char move[6];
+
+    uint64_t counts[MAX_MOVES];
+    uint64_t nodes;
+    double start, elapsed;
+
+    int threads = searchThreads();
+
+    initBoard(&board);
+
+    //Play the moves given, which have to be legal
+    for (int i = (divide) ? 2 : 1; i < argc; ++i)
+    {
+        findChecks(&board, white, &checks);
+        count = generateMoves(&board, white, GEN_ALL, &checks, moves);
+        for (k = 0; k < count; ++k)
+        {
+            //Promotions are always to a queen, so the piece can be left off
+            moveToString(moves[k], move);
+            if (strncmp(move, argv[i], 4) == 0)
+            {
+                break;
+            }
+        }
+
+        if (k == count)
+        {
+            printf("illegal move: %s\n", argv[i]);
+            return (1);
+        }
+
+        doMove(&board, moves[k], white, &undo);
+        white = !white;
+    }
+
+    //Subtrees reached by transposing moves are only counted once, it's
+    //  fine to count without the table if there isn't room for it
+    if (!initPerftTable(PERFT_TABLE_MB))
+    {
+        puts("Unable to allocate the perft table, counting without it");
+    }
+
+    start = wallTime();
+    if (!depth)
+    {
+        nodes = perft(&board, white, depth);
+    }
+    else if (divide)
+    {
+        nodes = perftDivide(&board, white, depth, threads);
+    }
+    else
+    {
+        nodes = perftSplit(&board, white, depth, threads, moves, counts,
+                &count);
+    }
+    elapsed = wallTime() - start;
+
+    printf("nodes: %" PRIu64 ", time: %f, nps: %.0f\n", nodes, elapsed,
+            (elapsed > 0) ? (double) nodes / elapsed : 0.0);
+
+    freePerftTable();
+
+    return (0);
+}
+
+/*
+ * Reads any --option arguments into search_options, and moves the remaining
+ *  arguments to the front of argv
+ *
+ * @modifies search_options
+ *
+ * @param argc The number of arguments
+ * @param argv The arguments
+ * @return The number of arguments left, including the program name
+ */
+int parseOptions(int argc, const char * argv[])
+{
+    int left = 1;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+        {
+            search_options.threads = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--parallel") == 0 && i + 1 < argc)
+        {
+            ++i;
+            if (strcmp(argv[i], "root") == 0)
+            {
+                search_options.parallel_mode = PARALLEL_ROOT_SPLIT;
+            }
+            else if (strcmp(argv[i], "ybwc") == 0)
+            {
+                search_options.parallel_mode = PARALLEL_YBWC;
+            }
+            else
+            {
+                search_options.parallel_mode = PARALLEL_LAZY_SMP;
+            }
+        }
+        else if (strcmp(argv[i], "--null-move") == 0 && i + 1 < argc)
+        {
+            //Plies to reduce the null move search by, or off
+            ++i;
+            search_options.null_move = (strcmp(argv[i], "off") != 0);
+            if (search_options.null_move)
+            {
+                search_options.null_move_reduction = (uint8_t) atoi(argv[i]);
+            }
+        }
+        else if (strcmp(argv[i], "--lmr") == 0 && i + 1 < argc)
+        {
+            //Moves to search at full depth before reducing, or off
+            ++i;
+            search_options.late_move_reductions = (strcmp(argv[i], "off") != 0);
+            if (search_options.late_move_reductions)
+            {
+                search_options.lmr_full_moves = (uint8_t) atoi(argv[i]);
+            }
+        }
+        else if (strcmp(argv[i], "--ponder") == 0)
+        {
+            search_options.ponder = true;
+        }
+        else if (strcmp(argv[i], "--lmr-depth") == 0 && i + 1 < argc)
+        {
+            //Reduced searches are a ply shallower, so this can't go below 2
+            int min_depth = atoi(argv[++i]);
+            search_options.lmr_min_depth = (uint8_t) ((min_depth < 2) ?
+                    2 : min_depth);
+        }
+        else
+        {
+            argv[left++] = argv[i];
+        }
+    }
+
+    return (left);
+}
+
 void getPlayerMove(char move[7])
 {
     puts("enter a move, e.g. PA2A3:");
@@ -116,7 +358,7 @@ void getPlayerMove(char move[7])
 }
 
 #ifdef PLAY_SELF
-void playSampleGame(uint8_t w_ply, uint8_t b_ply)
+void playSampleGame(uint8_t w_ply, uint8_t b_ply, double tlimit)
 {
     //Timers
     clock_t tstart, tend;
@@ -139,10 +381,18 @@ void playSampleGame(uint8_t w_ply, uint8_t b_ply)
 
     while (true)
     {
+        //Checkmated or stalemated
+        if (!hasLegalMoves(&current_state, true))
+        {
+            white_won = false;
+            draw = !inCheck(&current_state, true);
+            break;
+        }
+
         //white
         printf("white: turn %d\n", counter);
         tstart = clock();
-        selectBestMove(true, &current_state, &res, w_ply);
+        selectBestMove(true, &current_state, &res, tlimit, w_ply);
         tend = clock();
 
         getMoveString(&res, &current_state, true, plays[counter]);
@@ -153,9 +403,10 @@ void playSampleGame(uint8_t w_ply, uint8_t b_ply)
         ++counter;
         current_state = res;
 
-        if (current_state.b_piece_posns[15] == CAPTURED)
+        if (!hasLegalMoves(&current_state, false))
         {
             white_won = true;
+            draw = !inCheck(&current_state, false);
             break;
         }
 
@@ -165,7 +416,7 @@ void playSampleGame(uint8_t w_ply, uint8_t b_ply)
         //black
         printf("black: turn %d\n", counter);
         tstart = clock();
-        selectBestMove(false, &current_state, &res, b_ply);
+        selectBestMove(false, &current_state, &res, tlimit, b_ply);
         tend = clock();
 
         getMoveString(&res, &current_state, false, plays[counter]);
@@ -176,12 +427,6 @@ void playSampleGame(uint8_t w_ply, uint8_t b_ply)
         ++counter;
         current_state = res;
 
-        if (current_state.w_piece_posns[15] == CAPTURED)
-        {
-            white_won = false;
-            break;
-        }
-
         if (counter == 500)
         {
             puts("stalemate maybe...");
@@ -0,0 +1,344 @@
+/*
+ * perft.c
+ *
+ * Implementations of the functions defined in perft.h
+ *
+ * @author Js
+ *
+ */
+
+#ifdef PARALLEL_NEGAMAX
+#include <omp.h>
+#endif
+
+#include "perft.h"
+
+/*
+ * A slot of the count table. The count and depth are packed into data, and
+ *  check holds key ^ data, so that a slot torn by racing writes reads as a
+ *  miss, as in the transposition table.
+ */
+typedef struct
+{
+    _Atomic uint64_t check;
+    _Atomic uint64_t data;
+} perftslot;
+
+/*
+ * A move of the root and one of the replies to it, counted by a thread
+ */
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wpadded"
+typedef struct
+{
+    uint8_t root;
+    chessmove reply;
+} perftwork;
+#pragma clang diagnostic pop
+
+/*
+ * The table of subtree counts, indexed by the key of the position & depth
+ *  masked with perft_mask
+ *
+ * @users perft
+ * @initializer initPerftTable
+ */
+static perftslot * perft_table = NULL;
+static size_t perft_mask = 0;
+
+/*
+ * Allocates the table of subtree counts that perft() looks positions up in.
+ *  Any existing table is freed first.
+ *
+ * The number of slots is rounded down to a power of two so that indexing is
+ * a mask of the key.
+ *
+ * @modifies perft_table, perft_mask
+ *
+ * @param megabytes The size of the table in megabytes
+ * @return true if the table was allocated
+ */
+bool initPerftTable(size_t megabytes)
+{
+    size_t entries = 1;
+
+    freePerftTable();
+
+    //Largest power of two that fits
+    while (entries * 2 * sizeof(perftslot) <= megabytes * 1024 * 1024)
+    {
+        entries *= 2;
+    }
+
+    perft_table = calloc(entries, sizeof(perftslot));
+    if (!perft_table)
+    {
+        return (false);
+    }
+
+    perft_mask = entries - 1;
+    return (true);
+}
+
+/*
+ * Frees the table of subtree counts, perft() counts every subtree without it
+ *
+ * @modifies perft_table, perft_mask
+ */
+void freePerftTable(void)
+{
+    free(perft_table);
+    perft_table = NULL;
+    perft_mask = 0;
+}
+
+/*
+ * Counts the leaf nodes of the legal move tree below a board. The last ply
+ *  is bulk counted, its moves are generated but not made. Subtrees already
+ *  counted are looked up in the count table, if there is one.
+ *
+ * @uses location_boards, legal_moves, rook_attacks, bishop_attacks,
+ *       perft_table, perft_mask
+ * @modifies perft_table
+ *
+ * @param board The board to count from. Moves are made and unmade on it in
+ *              place, so it's unchanged on return
+ * @param white true if white is to move
+ * @param depth The number of plies to count to
+ * @return The number of positions depth plies below board
+ */
+uint64_t perft(chessboard * board, bool white, uint8_t depth)
+{
+    chessmove moves[MAX_MOVES];
+    checkinfo checks;
+    undoinfo undo;
+    uint64_t nodes = 0;
+    uint8_t count;
+
+    //The same position counted to a different depth is a different entry,
+    //  so the depth is mixed into the key
+    hashkey key = ((white) ? board->key : board->key ^ side_key)
+            ^ ((hashkey) depth * 0x9E3779B97F4A7C15);
+    perftslot * slot = NULL;
+    uint64_t data, check;
+
+    if (!depth)
+    {
+        return (1);
+    }
+
+    //Bulk counting is cheaper than a lookup, so only deeper subtrees are
+    //  kept in the table
+    if (perft_table && depth > 1)
+    {
+        slot = &perft_table[key & perft_mask];
+        data = atomic_load_explicit(&slot->data, memory_order_relaxed);
+        check = atomic_load_explicit(&slot->check, memory_order_relaxed);
+
+        //Empty slots have depth 0, so they never match
+        if ((check ^ data) == key && (uint8_t) data == depth)
+        {
+            return (data >> 8);
+        }
+    }
+
+    findChecks(board, white, &checks);
+    count = generateMoves(board, white, GEN_ALL, &checks, moves);
+
+    //Every generated move is legal, so the last ply is just the count
+    if (depth == 1)
+    {
+        return (count);
+    }
+
+    for (uint8_t i = 0; i < count; ++i)
+    {
+        doMove(board, moves[i], white, &undo);
+        nodes += perft(board, !white, depth - 1);
+        undoMove(board, moves[i], white, &undo);
+    }
+
+    if (slot)
+    {
+        data = (nodes << 8) | depth;
+        atomic_store_explicit(&slot->data, data, memory_order_relaxed);
+        atomic_store_explicit(&slot->check, key ^ data, memory_order_relaxed);
+    }
+
+    return (nodes);
+}
+
+/*
+ * Counts the leaf nodes below each move of a board. Under PARALLEL_NEGAMAX
+ *  each pair of a move and a reply to it is counted as a separate piece of
+ *  work, and the pieces are shared out between threads. If there's no
+ *  memory for the work, each move is counted with perft() instead.
+ *
+ * @uses location_boards, legal_moves, rook_attacks, bishop_attacks,
+ *       perft_table, perft_mask
+ * @modifies perft_table
+ *
+ * @param board The board to count from, which is unchanged on return
+ * @param white true if white is to move
+ * @param depth The number of plies to count to, at least 1
+ * @param threads The number of threads to count with
+ * @param moves An array of at least MAX_MOVES moves, filled with the moves
+ *              of board
+ * @param counts An array of at least MAX_MOVES counts, filled with the
+ *               count below each move
+ * @param count Filled with the number of moves
+ * @return The number of positions depth plies below board
+ */
+uint64_t perftSplit(chessboard * const board, bool white, uint8_t depth,
+        int threads, chessmove moves[], uint64_t counts[], uint8_t * count)
+{
+    chessboard position = *board;
+    checkinfo checks;
+    undoinfo undo;
+    chessmove replies[MAX_MOVES];
+    uint8_t reply_count;
+    uint64_t nodes = 0;
+
+    //Each root move has at most MAX_MOVES replies
+    perftwork * work = NULL;
+    size_t work_count = 0;
+
+    assert(depth > 0);
+
+    findChecks(&position, white, &checks);
+    *count = generateMoves(&position, white, GEN_ALL, &checks, moves);
+
+    if (depth > 2)
+    {
+        work = malloc((size_t) *count * MAX_MOVES * sizeof(perftwork));
+    }
+
+    for (uint8_t i = 0; i < *count; ++i)
+    {
+        counts[i] = 1;
+        if (depth == 1)
+        {
+            continue;
+        }
+
+        doMove(&position, moves[i], white, &undo);
+
+        //No room to share the work out, so count it all on this thread
+        if (depth > 2 && !work)
+        {
+            counts[i] = perft(&position, !white, depth - 1);
+            undoMove(&position, moves[i], white, &undo);
+            continue;
+        }
+
+        findChecks(&position, !white, &checks);
+        reply_count = generateMoves(&position, !white, GEN_ALL, &checks,
+                replies);
+        undoMove(&position, moves[i], white, &undo);
+
+        //Replies are bulk counted two plies down
+        counts[i] = reply_count;
+        if (depth == 2)
+        {
+            continue;
+        }
+
+        counts[i] = 0;
+        for (uint8_t j = 0; j < reply_count; ++j)
+        {
+            work[work_count].root = i;
+            work[work_count].reply = replies[j];
+            ++work_count;
+        }
+    }
+
+    //Hand the work out a piece at a time, some replies have much bigger
+    //  subtrees than others
+#ifdef PARALLEL_NEGAMAX
+#pragma omp parallel for num_threads(threads) schedule(dynamic, 1) \
+    shared(work, work_count, counts, moves, board, white, depth)
+#else
+    (void) threads;
+#endif
+    for (size_t w = 0; w < work_count; ++w)
+    {
+        chessboard local = *board;
+        undoinfo local_undo;
+        uint64_t sub;
+
+        doMove(&local, moves[work[w].root], white, &local_undo);
+        doMove(&local, work[w].reply, !white, &local_undo);
+        sub = perft(&local, white, depth - 2);
+
+#ifdef PARALLEL_NEGAMAX
+#pragma omp atomic
+#endif
+        counts[work[w].root] += sub;
+    }
+
+    free(work);
+
+    for (uint8_t i = 0; i < *count; ++i)
+    {
+        nodes += counts[i];
+    }
+
+    return (nodes);
+}
+
+/*
+ * Counts the leaf nodes below each move of a board, printing each move with
+ *  its count
+ *
+ * @uses location_boards, legal_moves, rook_attacks, bishop_attacks,
+ *       piece_chars, promotion_codes, perft_table, perft_mask
+ * @modifies perft_table
+ *
+ * @param board The board to count from, which is unchanged on return
+ * @param white true if white is to move
+ * @param depth The number of plies to count to, at least 1
+ * @param threads The number of threads to count with, see perftSplit()
+ * @return The number of positions depth plies below board
+ */
+uint64_t perftDivide(chessboard * const board, bool white, uint8_t depth,
+        int threads)
+{
+    chessmove moves[MAX_MOVES];
+    uint64_t counts[MAX_MOVES];
+    uint8_t count;
+    uint64_t nodes;
+    char move[6];
+
+    nodes = perftSplit(board, white, depth, threads, moves, counts, &count);
+
+    for (uint8_t i = 0; i < count; ++i)
+    {
+        moveToString(moves[i], move);
+        printf("%s: %" PRIu64 "\n", move, counts[i]);
+    }
+
+    printf("moves: %d\n", count);
+
+    return (nodes);
+}
+
+/*
+ * Writes a packed move in the form parseMoveString() reads, e.g. e2e4, or
+ *  e7e8Q for a promotion
+ *
+ * @uses piece_chars, promotion_codes
+ *
+ * @param mv The move to write
+ * @param out Filled with the move string
+ */
+void moveToString(chessmove mv, char out[6])
+{
+    squareToString(MOVE_FROM(mv), &out[0]);
+    squareToString(MOVE_TO(mv), &out[2]);
+
+    if (MOVE_FLAGS(mv) & MOVE_PROMOTION)
+    {
+        out[4] = piece_chars[promotion_codes[MOVE_FLAGS(mv) & PROMOTE_MASK]];
+        out[5] = '\0';
+    }
+}
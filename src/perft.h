@@ -0,0 +1,118 @@
+/*
+ * perft.h
+ *
+ * Contains the function definitions for counting the move tree of a position,
+ * used to check the move generator and to time it apart from the search
+ *
+ * @author Js
+ *
+ */
+
+#ifndef PERFT_H_
+#define PERFT_H_
+
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdatomic.h>
+
+#include "common_defs.h"
+#include "board.h"
+
+//Default size of the subtree count table in megabytes, override with
+//  -DPERFT_TABLE_MB=<n>
+#ifndef PERFT_TABLE_MB
+#define PERFT_TABLE_MB 256
+#endif
+
+/*
+ * Allocates the table of subtree counts that perft() looks positions up in.
+ *  Any existing table is freed first.
+ *
+ * @modifies perft_table, perft_mask
+ *
+ * @param megabytes The size of the table in megabytes
+ * @return true if the table was allocated
+ */
+bool initPerftTable(size_t megabytes);
+
+/*
+ * Frees the table of subtree counts, perft() counts every subtree without it
+ *
+ * @modifies perft_table, perft_mask
+ */
+void freePerftTable(void);
+
+/*
+ * Counts the leaf nodes of the legal move tree below a board. The last ply
+ *  is bulk counted, its moves are generated but not made. Subtrees already
+ *  counted are looked up in the count table, if there is one.
+ *
+ * @uses location_boards, legal_moves, rook_attacks, bishop_attacks,
+ *       perft_table, perft_mask
+ * @modifies perft_table
+ *
+ * @param board The board to count from. Moves are made and unmade on it in
+ *              place, so it's unchanged on return
+ * @param white true if white is to move
+ * @param depth The number of plies to count to
+ * @return The number of positions depth plies below board
+ */
+uint64_t perft(chessboard * board, bool white, uint8_t depth);
+
+/*
+ * Counts the leaf nodes below each move of a board. Under PARALLEL_NEGAMAX
+ *  each pair of a move and a reply to it is counted as a separate piece of
+ *  work, and the pieces are shared out between threads. If there's no
+ *  memory for the work, each move is counted with perft() instead.
+ *
+ * @uses location_boards, legal_moves, rook_attacks, bishop_attacks,
+ *       perft_table, perft_mask
+ * @modifies perft_table
+ *
+ * @param board The board to count from, which is unchanged on return
+ * @param white true if white is to move
+ * @param depth The number of plies to count to, at least 1
+ * @param threads The number of threads to count with
+ * @param moves An array of at least MAX_MOVES moves, filled with the moves
+ *              of board
+ * @param counts An array of at least MAX_MOVES counts, filled with the
+ *               count below each move
+ * @param count Filled with the number of moves
+ * @return The number of positions depth plies below board
+ */
+uint64_t perftSplit(chessboard * const board, bool white, uint8_t depth,
+        int threads, chessmove moves[], uint64_t counts[], uint8_t * count);
+
+/*
+ * Counts the leaf nodes below each move of a board, printing each move with
+ *  its count
+ *
+ * @uses location_boards, legal_moves, rook_attacks, bishop_attacks,
+ *       piece_chars, promotion_codes, perft_table, perft_mask
+ * @modifies perft_table
+ *
+ * @param board The board to count from, which is unchanged on return
+ * @param white true if white is to move
+ * @param depth The number of plies to count to, at least 1
+ * @param threads The number of threads to count with, see perftSplit()
+ * @return The number of positions depth plies below board
+ */
+uint64_t perftDivide(chessboard * const board, bool white, uint8_t depth,
+        int threads);
+
+/*
+ * Writes a packed move in the form parseMoveString() reads, e.g. e2e4, or
+ *  e7e8Q for a promotion
+ *
+ * @uses piece_chars, promotion_codes
+ *
+ * @param mv The move to write
+ * @param out Filled with the move string
+ */
+void moveToString(chessmove mv, char out[6]);
+
+#endif /* PERFT_H_ */
@@ -12,12 +12,13 @@
 /*
  * Generates the table of valid moves for each piece/position in addition to
  * the bitboards representing attacking squares for each piece/position. The
- * resulting table will be exported as a binary file to be used by
- * loadMoveTables()
+ * magic bitboard tables for the sliding pieces. The resulting tables will be
+ * exported as binary files to be used by loadMoveTables()
  *
  * @owner Js
  *
- * @modifies legal_moves, attacked_squares
+ * @modifies legal_moves, attacked_squares, rook_masks, bishop_masks,
+ *              rook_magics, bishop_magics, rook_attacks, bishop_attacks
  */
 void generateMoveTables(void)
 {
@@ -38,38 +39,44 @@ void generateMoveTables(void)
     {
         //Generate white moves
         //pawns
-        calcPawnMoves(i, legal_moves[W_P][i], attacked_squares[W_P][i], true);
+        calcPawnMoves(i, legal_moves[W_P][i], &attacked_squares[W_P][i],
+                true);
         //bishops
-        calcBishopMoves(i, legal_moves[W_B][i], attacked_squares[W_B][i]);
+        calcBishopMoves(i, legal_moves[W_B][i], &attacked_squares[W_B][i]);
         //knights
-        calcKnightMoves(i, legal_moves[W_N][i], attacked_squares[W_N][i]);
+        calcKnightMoves(i, legal_moves[W_N][i], &attacked_squares[W_N][i]);
         //rooks
-        calcRookMoves(i, legal_moves[W_R][i], attacked_squares[W_R][i]);
+        calcRookMoves(i, legal_moves[W_R][i], &attacked_squares[W_R][i]);
         //queen
-        calcQueenMoves(i, legal_moves[W_Q][i], attacked_squares[W_Q][i]);
+        calcQueenMoves(i, legal_moves[W_Q][i], &attacked_squares[W_Q][i]);
         //king
-        calcKingMoves(i, legal_moves[W_K][i], attacked_squares[W_K][i]);
+        calcKingMoves(i, legal_moves[W_K][i], &attacked_squares[W_K][i]);
 
         //Generate black moves
         //pawns
-        calcPawnMoves(i, legal_moves[B_P][i], attacked_squares[B_P][i], false);
+        calcPawnMoves(i, legal_moves[B_P][i], &attacked_squares[B_P][i],
+                false);
         //bishops
-        calcBishopMoves(i, legal_moves[B_B][i], attacked_squares[B_B][i]);
+        calcBishopMoves(i, legal_moves[B_B][i], &attacked_squares[B_B][i]);
         //knights
-        calcKnightMoves(i, legal_moves[B_N][i], attacked_squares[B_N][i]);
+        calcKnightMoves(i, legal_moves[B_N][i], &attacked_squares[B_N][i]);
         //rooks
-        calcRookMoves(i, legal_moves[B_R][i], attacked_squares[B_R][i]);
+        calcRookMoves(i, legal_moves[B_R][i], &attacked_squares[B_R][i]);
         //queen
-        calcQueenMoves(i, legal_moves[B_Q][i], attacked_squares[B_Q][i]);
+        calcQueenMoves(i, legal_moves[B_Q][i], &attacked_squares[B_Q][i]);
         //king
-        calcKingMoves(i, legal_moves[B_K][i], attacked_squares[B_K][i]);
+        calcKingMoves(i, legal_moves[B_K][i], &attacked_squares[B_K][i]);
     }
 
+    //The slider tables are built from the rays above
+    generateMagics();
+
     //Table files in local directory
     FILE * move_table = fopen("move_table.bin", "wb");
-    FILE * atk_table = fopen("atk_boards.bin", "wb");
+    FILE * atk_table = fopen("atk_table.bin", "wb");
+    FILE * magic_table = fopen("magic_table.bin", "wb");
 
-    if (!move_table || !atk_table)
+    if (!move_table || !atk_table || !magic_table)
     {
         puts("Unable to write table files. Work will not be saved!");
     }
@@ -80,9 +87,19 @@ void generateMoveTables(void)
         fwrite(legal_moves, sizeof(uint8_t), 12 * 64 * 8 * 7, move_table);
         //12 different pieces, 64 squares
         fwrite(attacked_squares, sizeof(bitboard), 12 * 64, atk_table);
+        //Masks & magics for 64 squares, then the attacks for each index
+        fwrite(rook_masks, sizeof(bitboard), 64, magic_table);
+        fwrite(bishop_masks, sizeof(bitboard), 64, magic_table);
+        fwrite(rook_magics, sizeof(uint64_t), 64, magic_table);
+        fwrite(bishop_magics, sizeof(uint64_t), 64, magic_table);
+        fwrite(rook_attacks, sizeof(bitboard), 64 << ROOK_INDEX_BITS,
+                magic_table);
+        fwrite(bishop_attacks, sizeof(bitboard), 64 << BISHOP_INDEX_BITS,
+                magic_table);
 
         fclose(move_table);
         fclose(atk_table);
+        fclose(magic_table);
 
         puts("Table files generated successfully");
     }
@@ -94,21 +111,34 @@ void generateMoveTables(void)
  *
  * @owner Js
  *
- * @modifies legal_moves, attacked_squares
+ * @modifies legal_moves, attacked_squares, rook_masks, bishop_masks,
+ *              rook_magics, bishop_magics, rook_attacks, bishop_attacks
  *
  * @returns true if the file loaded successfully, false if some error occurred
- *          which prevented a successful initialization of legal_moves and
- *          attacked_squares.
+ *          which prevented a successful initialization of the tables.
  */
 bool loadMoveTables(void)
 {
     //Table files in local directory
     FILE * move_table = fopen("move_table.bin", "rb");
-    FILE * atk_table = fopen("atk_boards.bin", "rb");
+    FILE * atk_table = fopen("atk_table.bin", "rb");
+    FILE * magic_table = fopen("magic_table.bin", "rb");
 
-    if (!move_table || !atk_table)
+    if (!move_table || !atk_table || !magic_table)
     {
         puts("Unable to open table files for reading...");
+        if (move_table)
+        {
+            fclose(move_table);
+        }
+        if (atk_table)
+        {
+            fclose(atk_table);
+        }
+        if (magic_table)
+        {
+            fclose(magic_table);
+        }
         return (false);
     }
     else
@@ -118,9 +148,19 @@ bool loadMoveTables(void)
         fread(legal_moves, sizeof(uint8_t), 12 * 64 * 8 * 7, move_table);
         //12 different pieces, 64 squares
         fread(attacked_squares, sizeof(bitboard), 12 * 64, atk_table);
+        //Masks & magics for 64 squares, then the attacks for each index
+        fread(rook_masks, sizeof(bitboard), 64, magic_table);
+        fread(bishop_masks, sizeof(bitboard), 64, magic_table);
+        fread(rook_magics, sizeof(uint64_t), 64, magic_table);
+        fread(bishop_magics, sizeof(uint64_t), 64, magic_table);
+        fread(rook_attacks, sizeof(bitboard), 64 << ROOK_INDEX_BITS,
+                magic_table);
+        fread(bishop_attacks, sizeof(bitboard), 64 << BISHOP_INDEX_BITS,
+                magic_table);
 
         fclose(move_table);
         fclose(atk_table);
+        fclose(magic_table);
         puts("Table files loaded successfully");
 
 #ifdef DEBUG_QUEEN
@@ -144,15 +184,249 @@ bool loadMoveTables(void)
 }
 
 /*
- * Populates the hashkey table for the board with randomly generated N-bit
- * values, where N is the bitwidth of HASHKEY.
- *
- * @modifies key_table
- void generateHashkeys()
- {
- //TODO Generate the hashkey tables
- }
+ * Finds a magic for every square for the rooks and bishops, and fills in the
+ * attack tables with them. The rays of the rook and bishop in legal_moves
+ * must already be generated.
+ *
+ * The magics are found by trial, with a fixed seed so that the same ones are
+ * found every time.
+ *
+ * @owner Js
+ *
+ * @uses legal_moves
+ *
+ * @modifies rook_masks, bishop_masks, rook_magics, bishop_magics,
+ *              rook_attacks, bishop_attacks
+ */
+void generateMagics(void)
+{
+    uint64_t seed = UINT64_C(0x2545F4914F6CDD1D);
+
+    for (uint8_t i = 0; i < 64; ++i)
+    {
+        rook_masks[i] = calcSliderMask(legal_moves[W_R][i]);
+        rook_magics[i] = findMagic(legal_moves[W_R][i], rook_masks[i],
+                ROOK_INDEX_BITS, rook_attacks[i], &seed);
+
+        bishop_masks[i] = calcSliderMask(legal_moves[W_B][i]);
+        bishop_magics[i] = findMagic(legal_moves[W_B][i], bishop_masks[i],
+                BISHOP_INDEX_BITS, bishop_attacks[i], &seed);
+    }
+}
+
+/*
+ * Calculates the squares that can block a slider. This is every square on
+ * its rays except the last, since nothing lies beyond it to block.
+ *
+ * @owner Js
+ *
+ * @uses location_boards
+ *
+ * @param rays The rays of the slider, from legal_moves
+ * @return The bitboard of squares that can block the slider
+ */
+bitboard calcSliderMask(uint8_t rays[8][7])
+{
+    bitboard mask = 0;
+
+    for (uint8_t i = 0; i < 8; ++i)
+    {
+        for (uint8_t j = 0; j < 6 && rays[i][j + 1] != INVALID_SQUARE; ++j)
+        {
+            mask |= location_boards[rays[i][j]];
+        }
+    }
+
+    return (mask);
+}
+
+/*
+ * Calculates the squares attacked by a slider by walking its rays, stopping
+ * each one at the first occupied square
+ *
+ * @owner Js
+ *
+ * @uses location_boards
+ *
+ * @param rays The rays of the slider, from legal_moves
+ * @param occupied The occupied squares of the board
+ * @return The bitboard of attacked squares, including occupied ones
+ */
+bitboard calcSliderAttacks(uint8_t rays[8][7], bitboard occupied)
+{
+    bitboard attacks = 0;
+
+    for (uint8_t i = 0; i < 8; ++i)
+    {
+        for (uint8_t j = 0; j < 7 && rays[i][j] != INVALID_SQUARE; ++j)
+        {
+            attacks |= location_boards[rays[i][j]];
+            if (location_boards[rays[i][j]] & occupied)
+            {
+                break;
+            }
+        }
+    }
+
+    return (attacks);
+}
+
+/*
+ * Finds a magic for a slider on a square, which maps every subset of its
+ * mask to an index without two subsets with different attacks colliding
+ *
+ * @owner Js
+ *
+ * @param rays The rays of the slider, from legal_moves
+ * @param mask The blocking squares of the slider, from calcSliderMask()
+ * @param bits The number of bits in an index
+ * @param attacks The table of attacks to fill, 1 << bits long
+ * @param seed The state of the generator used to make candidates
+ * @return The magic
+ */
+uint64_t findMagic(uint8_t rays[8][7], bitboard mask, uint8_t bits,
+        bitboard attacks[], uint64_t * seed)
+{
+    //Every subset of the mask and the attacks for it
+    bitboard occupied[1 << ROOK_INDEX_BITS];
+    bitboard reference[1 << ROOK_INDEX_BITS];
+    uint16_t count = 0;
+    bitboard subset = 0;
+    uint64_t magic;
+    uint16_t index;
+    bool fits;
+
+    //Enumerate the subsets by carrying through the bits of the mask
+    do
+    {
+        occupied[count] = subset;
+        reference[count++] = calcSliderAttacks(rays, subset);
+        subset = (subset - mask) & mask;
+    } while (subset);
+
+    do
+    {
+        //Candidates with few bits set work best
+        magic = nextRandom(seed) & nextRandom(seed) & nextRandom(seed);
+
+        //Not enough bits making it to the top for it to be worth a try
+        if (__builtin_popcountll((mask * magic) >> 56) < 6)
+        {
+            fits = false;
+            continue;
+        }
+
+        //A slider always attacks something, so 0 means the index is unused
+        memset(attacks, 0, sizeof(bitboard) << bits);
+        fits = true;
+        for (uint16_t i = 0; i < count && fits; ++i)
+        {
+            index = (uint16_t) ((occupied[i] * magic) >> (64 - bits));
+            if (!attacks[index])
+            {
+                attacks[index] = reference[i];
+            }
+            else if (attacks[index] != reference[i])
+            {
+                fits = false;
+            }
+        }
+    } while (!fits);
+
+    return (magic);
+}
+
+/*
+ * Populates the hashkey tables for the board with randomly generated 64-bit
+ * values. The generator is seeded with a fixed value, so every run of the
+ * program produces the same set of keys.
+ *
+ * Uses xorshift64*, rand() doesn't give enough bits to be useful here
+ *
+ * @owner Js
+ *
+ * @modifies key_table, castle_keys, side_key
+ */
+void generateHashkeys(void)
+{
+    uint64_t seed = UINT64_C(0x9E3779B97F4A7C15);
+
+    for (uint8_t i = 0; i < 12; ++i)
+    {
+        for (uint8_t j = 0; j < 64; ++j)
+        {
+            key_table[i][j] = nextRandom(&seed);
+        }
+    }
+
+    for (uint8_t i = 0; i < 2; ++i)
+    {
+        //No castling rights hashes to 0, so a board that can't castle
+        //  doesn't need to worry about it
+        castle_keys[i][0] = 0;
+        for (uint8_t j = 1; j < 4; ++j)
+        {
+            castle_keys[i][j] = nextRandom(&seed);
+        }
+    }
+
+    side_key = nextRandom(&seed);
+}
+
+/*
+ * Fills in the combined material and position tables that the evaluation
+ * sums over the board
+ *
+ * @owner Js
+ *
+ * @uses piece_vals, board_position_vals, w_K_e_positions, b_K_e_positions
+ *
+ * @modifies piece_square_vals
+ */
+void generateEvalTables(void)
+{
+    const int8_t * positions;
+
+    memset(piece_square_vals, 0, sizeof(piece_square_vals));
+
+    for (uint8_t endgame = 0; endgame < 2; ++endgame)
+    {
+        for (uint8_t code = 0; code < 12; ++code)
+        {
+            positions = board_position_vals[code];
+            //Only the kings change tables in the endgame
+            if (endgame && code == W_K)
+            {
+                positions = w_K_e_positions;
+            }
+            else if (endgame && code == B_K)
+            {
+                positions = b_K_e_positions;
+            }
+
+            for (uint8_t sq = 0; sq < 64; ++sq)
+            {
+                piece_square_vals[endgame][code][sq] = (code < B_P) ?
+                        piece_vals[code] + positions[sq] :
+                        -(piece_vals[code] + positions[sq]);
+            }
+        }
+    }
+}
+
+/*
+ * Advances an xorshift64* generator and returns the next value
+ *
+ * @param state The generator state, must not be 0
+ * @return The next pseudorandom 64-bit value
  */
+uint64_t nextRandom(uint64_t * state)
+{
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return (*state * UINT64_C(2685821657736338717));
+}
 
 /*
  * Calculates the moves available to a pawn piece from a location
@@ -166,13 +440,13 @@ bool loadMoveTables(void)
  *              They will be in order from left to right
  *              (from white's perspective).
  *              Assumes that it is preset to INVALID
- * @param atk_bboard The attack bitboard to configure for the location
+ * @param atkbboard The attack bitboard to configure for the location
  *                      It is assumed to be set to 0.
  *                      Does not account for en passant captures
  * @param white true if calculating moves for the white pieces
  */
-void calcPawnMoves(uint8_t location, uint8_t moves[8][7], bitboard atkbboard,
-bool white)
+void calcPawnMoves(uint8_t location, uint8_t moves[8][7],
+        bitboard * atkbboard, bool white)
 {
     int8_t delta = (white) ? 8 : -8;
     //If location / 8 == 7, then it's a value in the range 56-63
@@ -192,12 +466,18 @@ bool white)
         //Update the attack bitboard, pawns can only cap diagonally
         // This does not account for en passant captures
         moves[1][0] = (col == 7) ? INVALID_SQUARE : (moves[0][0] + 1);
-        atkbboard |= location_boards[moves[1][0]];
+        if (moves[1][0] != INVALID_SQUARE)
+        {
+            *atkbboard |= location_boards[moves[1][0]];
+        }
 
         //Check for left edge, if location % 8 == 0, then it's a leftmost square
         //  and can have no up/left value, otherwise move up a row and back 1
         moves[7][0] = (col == 0) ? INVALID_SQUARE : (moves[0][0] - 1);
-        atkbboard |= location_boards[moves[7][0]];
+        if (moves[7][0] != INVALID_SQUARE)
+        {
+            *atkbboard |= location_boards[moves[7][0]];
+        }
     }
     //Pawns can move 2 moves from start position, so account for special case
     if ((white && ((location / 8) == 1)) || (!white && ((location / 8) == 6)))
@@ -219,10 +499,11 @@ bool white)
  *              They will travel clockwise from the top-right
  *              (from white's perspective)
  *              Assumes that it is preset to INVALID
- * @param atk_bboard The attack bitboard to configure for the location
+ * @param atkbboard The attack bitboard to configure for the location
  *                      It is assumed to be set to 0.
  */
-void calcKnightMoves(uint8_t location, uint8_t moves[8][7], bitboard atkbboard)
+void calcKnightMoves(uint8_t location, uint8_t moves[8][7],
+        bitboard * atkbboard)
 {
     //Check if location allows movement upwards, and how much
     //  Needed for up2/right, right2/up, up2/left, left2/up
@@ -274,9 +555,8 @@ void calcKnightMoves(uint8_t location, uint8_t moves[8][7], bitboard atkbboard)
     //update the attack bitboard
     for (uint8_t i = 0; i < 8; ++i)
     {
-        atkbboard =
-                (moves[i][0] != INVALID_SQUARE) ?
-                        atkbboard | (location_boards[moves[i][0]]) : atkbboard;
+        *atkbboard |= (moves[i][0] != INVALID_SQUARE) ?
+                location_boards[moves[i][0]] : 0;
     }
 }
 
@@ -294,10 +574,11 @@ void calcKnightMoves(uint8_t location, uint8_t moves[8][7], bitboard atkbboard)
  *              filled clockwise from the top
  *              (from white's perspective)
  *              Assumes that it is preset to INVALID
- * @param atk_bboard The attack bitboard to configure for the location
+ * @param atkbboard The attack bitboard to configure for the location
  *                      It is assumed to be set to 0.
  */
-void calcBishopMoves(uint8_t location, uint8_t moves[4][7], bitboard atkbboard)
+void calcBishopMoves(uint8_t location, uint8_t moves[4][7],
+        bitboard * atkbboard)
 {
     //This is the same as for the queen, but without the
     //  vertical/horizontal moves
@@ -325,18 +606,10 @@ void calcBishopMoves(uint8_t location, uint8_t moves[4][7], bitboard atkbboard)
         moves[3][i] = (NW < INVALID_SQUARE) ? NW : INVALID_SQUARE;
 
         //Update attack bitboards
-        atkbboard =
-                (NE < INVALID_SQUARE) ?
-                        atkbboard | (location_boards[moves[0][i]]) : atkbboard;
-        atkbboard =
-                (SE < INVALID_SQUARE) ?
-                        atkbboard | (location_boards[moves[1][i]]) : atkbboard;
-        atkbboard =
-                (SW < INVALID_SQUARE) ?
-                        atkbboard | (location_boards[moves[2][i]]) : atkbboard;
-        atkbboard =
-                (NW < INVALID_SQUARE) ?
-                        atkbboard | (location_boards[moves[3][i]]) : atkbboard;
+        *atkbboard |= (NE < INVALID_SQUARE) ? location_boards[moves[0][i]] : 0;
+        *atkbboard |= (SE < INVALID_SQUARE) ? location_boards[moves[1][i]] : 0;
+        *atkbboard |= (SW < INVALID_SQUARE) ? location_boards[moves[2][i]] : 0;
+        *atkbboard |= (NW < INVALID_SQUARE) ? location_boards[moves[3][i]] : 0;
     }
 }
 
@@ -354,10 +627,11 @@ void calcBishopMoves(uint8_t location, uint8_t moves[4][7], bitboard atkbboard)
  *              filled clockwise from the top
  *              (from white's perspective)
  *              Assumes that it is preset to INVALID
- * @param atk_bboard The attack bitboard to configure for the location
+ * @param atkbboard The attack bitboard to configure for the location
  *                      It is assumed to be set to 0.
  */
-void calcRookMoves(uint8_t location, uint8_t moves[4][7], bitboard atkbboard)
+void calcRookMoves(uint8_t location, uint8_t moves[4][7],
+        bitboard * atkbboard)
 {
     //Same as for queen, but only horizontal/vertical
     uint8_t N, E, S, W;
@@ -382,18 +656,10 @@ void calcRookMoves(uint8_t location, uint8_t moves[4][7], bitboard atkbboard)
         moves[3][i] = (W < INVALID_SQUARE) ? W : INVALID_SQUARE;
 
         //Update attack bitboards
-        atkbboard =
-                (N < INVALID_SQUARE) ?
-                        atkbboard | (location_boards[moves[0][i]]) : atkbboard;
-        atkbboard =
-                (E < INVALID_SQUARE) ?
-                        atkbboard | (location_boards[moves[1][i]]) : atkbboard;
-        atkbboard =
-                (S < INVALID_SQUARE) ?
-                        atkbboard | (location_boards[moves[2][i]]) : atkbboard;
-        atkbboard =
-                (W < INVALID_SQUARE) ?
-                        atkbboard | (location_boards[moves[3][i]]) : atkbboard;
+        *atkbboard |= (N < INVALID_SQUARE) ? location_boards[moves[0][i]] : 0;
+        *atkbboard |= (E < INVALID_SQUARE) ? location_boards[moves[1][i]] : 0;
+        *atkbboard |= (S < INVALID_SQUARE) ? location_boards[moves[2][i]] : 0;
+        *atkbboard |= (W < INVALID_SQUARE) ? location_boards[moves[3][i]] : 0;
     }
 }
 
@@ -411,10 +677,11 @@ void calcRookMoves(uint8_t location, uint8_t moves[4][7], bitboard atkbboard)
  *              filled clockwise from the top
  *              (from white's perspective)
  *              Assumes that it is preset to INVALID
- * @param atk_bboard The attack bitboard to configure for the location
+ * @param atkbboard The attack bitboard to configure for the location
  *                      It is assumed to be set to 0.
  */
-void calcQueenMoves(uint8_t location, uint8_t moves[8][7], bitboard atkbboard)
+void calcQueenMoves(uint8_t location, uint8_t moves[8][7],
+        bitboard * atkbboard)
 {
     uint8_t N, NE, E, SE, S, SW, W, NW;
     N = NE = E = SE = S = SW = W = NW = location;
@@ -454,30 +721,14 @@ void calcQueenMoves(uint8_t location, uint8_t moves[8][7], bitboard atkbboard)
         moves[7][i] = (NW < INVALID_SQUARE) ? NW : INVALID_SQUARE;
 
         //Update attack bitboards
-        atkbboard =
-                (N < INVALID_SQUARE) ?
-                        atkbboard | (location_boards[moves[0][i]]) : atkbboard;
-        atkbboard =
-                (NE < INVALID_SQUARE) ?
-                        atkbboard | (location_boards[moves[1][i]]) : atkbboard;
-        atkbboard =
-                (E < INVALID_SQUARE) ?
-                        atkbboard | (location_boards[moves[2][i]]) : atkbboard;
-        atkbboard =
-                (SE < INVALID_SQUARE) ?
-                        atkbboard | (location_boards[moves[3][i]]) : atkbboard;
-        atkbboard =
-                (S < INVALID_SQUARE) ?
-                        atkbboard | (location_boards[moves[4][i]]) : atkbboard;
-        atkbboard =
-                (SW < INVALID_SQUARE) ?
-                        atkbboard | (location_boards[moves[5][i]]) : atkbboard;
-        atkbboard =
-                (W < INVALID_SQUARE) ?
-                        atkbboard | (location_boards[moves[6][i]]) : atkbboard;
-        atkbboard =
-                (NW < INVALID_SQUARE) ?
-                        atkbboard | (location_boards[moves[7][i]]) : atkbboard;
+        *atkbboard |= (N < INVALID_SQUARE) ? location_boards[moves[0][i]] : 0;
+        *atkbboard |= (NE < INVALID_SQUARE) ? location_boards[moves[1][i]] : 0;
+        *atkbboard |= (E < INVALID_SQUARE) ? location_boards[moves[2][i]] : 0;
+        *atkbboard |= (SE < INVALID_SQUARE) ? location_boards[moves[3][i]] : 0;
+        *atkbboard |= (S < INVALID_SQUARE) ? location_boards[moves[4][i]] : 0;
+        *atkbboard |= (SW < INVALID_SQUARE) ? location_boards[moves[5][i]] : 0;
+        *atkbboard |= (W < INVALID_SQUARE) ? location_boards[moves[6][i]] : 0;
+        *atkbboard |= (NW < INVALID_SQUARE) ? location_boards[moves[7][i]] : 0;
     }
 }
 
@@ -494,10 +745,11 @@ void calcQueenMoves(uint8_t location, uint8_t moves[8][7], bitboard atkbboard)
  *              piece, traveling clockwise from the top
  *              (from white's perspective)
  *              Assumes that it is preset to INVALID
- * @param atk_bboard The attack bitboard to configure for the location
+ * @param atkbboard The attack bitboard to configure for the location
  *                      It is assumed to be set to 0.
  */
-void calcKingMoves(uint8_t location, uint8_t moves[8][7], bitboard atkbboard)
+void calcKingMoves(uint8_t location, uint8_t moves[8][7],
+        bitboard * atkbboard)
 {
     bool can_up = (location / 8 < 7);
     bool can_down = (location / 8 > 0);
@@ -523,9 +775,8 @@ void calcKingMoves(uint8_t location, uint8_t moves[8][7], bitboard atkbboard)
 
     for (uint8_t i = 0; i < 8; ++i)
     {
-        atkbboard =
-                (moves[i][0] != INVALID_SQUARE) ?
-                        atkbboard | (location_boards[moves[i][0]]) : atkbboard;
+        *atkbboard |= (moves[i][0] != INVALID_SQUARE) ?
+                location_boards[moves[i][0]] : 0;
     }
 }
 
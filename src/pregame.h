@@ -21,13 +21,14 @@
 #include "board.h"
 /*
  * Generates the table of valid moves for each piece/position in addition to
- * the bitboards representing attacking squares for each piece/position. The
- * resulting table will be exported as a binary file to be used by
- * loadMoveTables()
+ * the bitboards representing attacking squares for each piece/position, and
+ * magic bitboard tables for the sliding pieces. The resulting tables will be
+ * exported as binary files to be used by loadMoveTables()
  *
  * @owner Js
  *
- * @modifies legal_moves, attacked_squares
+ * @modifies legal_moves, attacked_squares, rook_masks, bishop_masks,
+ *              rook_magics, bishop_magics, rook_attacks, bishop_attacks
  */
 void generateMoveTables(void);
 
@@ -37,21 +38,101 @@ void generateMoveTables(void);
  *
  * @owner Js
  *
- * @modifies legal_moves, attacked_squares
+ * @modifies legal_moves, attacked_squares, rook_masks, bishop_masks,
+ *              rook_magics, bishop_magics, rook_attacks, bishop_attacks
  *
  * @returns true if the file loaded successfully, false if some error occurred
- *          which prevented a successful initialization of legal_moves and
- *          attacked_squares.
+ *          which prevented a successful initialization of the tables.
  */
 bool loadMoveTables(void);
 
 /*
- * Populates the hashkey table for the board with randomly generated N-bit
- * values, where N is the bitwidth of HASHKEY.
+ * Finds a magic for every square for the rooks and bishops, and fills in the
+ * attack tables with them. The rays of the rook and bishop in legal_moves
+ * must already be generated.
  *
- * @modifies key_table
- void generateHashkeys();
+ * @owner Js
+ *
+ * @uses legal_moves
+ *
+ * @modifies rook_masks, bishop_masks, rook_magics, bishop_magics,
+ *              rook_attacks, bishop_attacks
+ */
+void generateMagics(void);
+
+/*
+ * Calculates the squares that can block a slider. This is every square on
+ * its rays except the last, since nothing lies beyond it to block.
+ *
+ * @owner Js
+ *
+ * @uses location_boards
+ *
+ * @param rays The rays of the slider, from legal_moves
+ * @return The bitboard of squares that can block the slider
+ */
+bitboard calcSliderMask(uint8_t rays[8][7]);
+
+/*
+ * Calculates the squares attacked by a slider by walking its rays, stopping
+ * each one at the first occupied square
+ *
+ * @owner Js
+ *
+ * @uses location_boards
+ *
+ * @param rays The rays of the slider, from legal_moves
+ * @param occupied The occupied squares of the board
+ * @return The bitboard of attacked squares, including occupied ones
+ */
+bitboard calcSliderAttacks(uint8_t rays[8][7], bitboard occupied);
+
+/*
+ * Finds a magic for a slider on a square, which maps every subset of its
+ * mask to an index without two subsets with different attacks colliding
+ *
+ * @owner Js
+ *
+ * @param rays The rays of the slider, from legal_moves
+ * @param mask The blocking squares of the slider, from calcSliderMask()
+ * @param bits The number of bits in an index
+ * @param attacks The table of attacks to fill, 1 << bits long
+ * @param seed The state of the generator used to make candidates
+ * @return The magic
+ */
+uint64_t findMagic(uint8_t rays[8][7], bitboard mask, uint8_t bits,
+        bitboard attacks[], uint64_t * seed);
+
+/*
+ * Populates the hashkey tables for the board with randomly generated 64-bit
+ * values. The generator is seeded with a fixed value, so every run of the
+ * program produces the same set of keys.
+ *
+ * @owner Js
+ *
+ * @modifies key_table, castle_keys, side_key
+ */
+void generateHashkeys(void);
+
+/*
+ * Fills in the combined material and position tables that the evaluation
+ * sums over the board
+ *
+ * @owner Js
+ *
+ * @uses piece_vals, board_position_vals, w_K_e_positions, b_K_e_positions
+ *
+ * @modifies piece_square_vals
+ */
+void generateEvalTables(void);
+
+/*
+ * Advances an xorshift64* generator and returns the next value
+ *
+ * @param state The generator state, must not be 0
+ * @return The next pseudorandom 64-bit value
  */
+uint64_t nextRandom(uint64_t * state);
 
 /*
  * Calculates the moves available to a pawn piece from a location
@@ -65,13 +146,13 @@ bool loadMoveTables(void);
  *              They will be in order from left to right
  *              (from white's perspective).
  *              Assumes that it is preset to INVALID
- * @param atk_bboard The attack bitboard to configure for the location
+ * @param atkbboard The attack bitboard to configure for the location
  *                      It is assumed to be set to 0.
  *                      Does not account for en passant captures
  * @param white true if calculating moves for the white pieces
  */
-void calcPawnMoves(uint8_t location, uint8_t moves[8][7], bitboard atkbboard,
-bool white);
+void calcPawnMoves(uint8_t location, uint8_t moves[8][7],
+        bitboard * atkbboard, bool white);
 
 /*
  * Calculates the moves available to a knight piece from a location
@@ -85,10 +166,11 @@ bool white);
  *              They will travel clockwise from the top-right
  *              (from white's perspective)
  *              Assumes that it is preset to INVALID
- * @param atk_bboard The attack bitboard to configure for the location
+ * @param atkbboard The attack bitboard to configure for the location
  *                      It is assumed to be set to 0.
  */
-void calcKnightMoves(uint8_t location, uint8_t moves[8][7], bitboard atkbboard);
+void calcKnightMoves(uint8_t location, uint8_t moves[8][7],
+        bitboard * atkbboard);
 
 /*
  * Calculates the moves available to a bishop piece from a location
@@ -104,10 +186,11 @@ void calcKnightMoves(uint8_t location, uint8_t moves[8][7], bitboard atkbboard);
  *              filled clockwise from the top
  *              (from white's perspective)
  *              Assumes that it is preset to INVALID
- * @param atk_bboard The attack bitboard to configure for the location
+ * @param atkbboard The attack bitboard to configure for the location
  *                      It is assumed to be set to 0.
  */
-void calcBishopMoves(uint8_t location, uint8_t moves[4][7], bitboard atkbboard);
+void calcBishopMoves(uint8_t location, uint8_t moves[4][7],
+        bitboard * atkbboard);
 
 /*
  * Calculates the moves available to a rook piece from a location
@@ -123,10 +206,11 @@ void calcBishopMoves(uint8_t location, uint8_t moves[4][7], bitboard atkbboard);
  *              filled clockwise from the top
  *              (from white's perspective)
  *              Assumes that it is preset to INVALID
- * @param atk_bboard The attack bitboard to configure for the location
+ * @param atkbboard The attack bitboard to configure for the location
  *                      It is assumed to be set to 0.
  */
-void calcRookMoves(uint8_t location, uint8_t moves[4][7], bitboard atkbboard);
+void calcRookMoves(uint8_t location, uint8_t moves[4][7],
+        bitboard * atkbboard);
 
 /*
  * Calculates the moves available to a queen piece from a location
@@ -142,10 +226,11 @@ void calcRookMoves(uint8_t location, uint8_t moves[4][7], bitboard atkbboard);
  *              filled clockwise from the top
  *              (from white's perspective)
  *              Assumes that it is preset to INVALID
- * @param atk_bboard The attack bitboard to configure for the location
+ * @param atkbboard The attack bitboard to configure for the location
  *                      It is assumed to be set to 0.
  */
-void calcQueenMoves(uint8_t location, uint8_t moves[8][7], bitboard atkbboard);
+void calcQueenMoves(uint8_t location, uint8_t moves[8][7],
+        bitboard * atkbboard);
 
 /*
  * Calculates the moves available to a king from a location
@@ -160,9 +245,10 @@ void calcQueenMoves(uint8_t location, uint8_t moves[8][7], bitboard atkbboard);
  *              piece, traveling clockwise from the top
  *              (from white's perspective)
  *              Assumes that it is preset to INVALID
- * @param atk_bboard The attack bitboard to configure for the location
+ * @param atkbboard The attack bitboard to configure for the location
  *                      It is assumed to be set to 0.
  */
-void calcKingMoves(uint8_t location, uint8_t moves[8][7], bitboard atkbboard);
+void calcKingMoves(uint8_t location, uint8_t moves[8][7],
+        bitboard * atkbboard);
 
 #endif /* PREGAME_H_ */
@@ -0,0 +1,148 @@
+/*
+ * ttable.c
+ *
+ * Implementations of the functions defined in ttable.h
+ *
+ * @author Js
+ *
+ */
+
+#include "ttable.h"
+
+/*
+ * A slot of the table as it is stored. The entry is packed into data, and
+ *  check holds key ^ data. Threads share the table without locking, so if two
+ *  racing writes tear a slot, the check fails and the slot reads as a miss.
+ */
+typedef struct
+{
+    _Atomic uint64_t check;
+    _Atomic uint64_t data;
+} ttslot;
+
+/*
+ * The transposition table, indexed by key & tt_mask
+ *
+ * @users brain
+ * @initializer initTransTable
+ */
+static ttslot * tt_table = NULL;
+static size_t tt_mask = 0;
+
+/*
+ * Allocates the transposition table. Any existing table is freed first.
+ *
+ * The number of entries is rounded down to a power of two so that indexing is
+ * a mask of the key.
+ *
+ * @modifies tt_table, tt_mask
+ *
+ * @param megabytes The size of the table in megabytes
+ * @return true if the table was allocated
+ */
+bool initTransTable(size_t megabytes)
+{
+    size_t entries = 1;
+
+    freeTransTable();
+
+    //Largest power of two that fits
+    while (entries * 2 * sizeof(ttslot) <= megabytes * 1024 * 1024)
+    {
+        entries *= 2;
+    }
+
+    tt_table = calloc(entries, sizeof(ttslot));
+    if (!tt_table)
+    {
+        return (false);
+    }
+
+    tt_mask = entries - 1;
+    return (true);
+}
+
+/*
+ * Frees the transposition table
+ *
+ * @modifies tt_table, tt_mask
+ */
+void freeTransTable(void)
+{
+    free(tt_table);
+    tt_table = NULL;
+    tt_mask = 0;
+}
+
+/*
+ * Looks up a position in the transposition table
+ *
+ * @uses tt_table, tt_mask
+ *
+ * @param key The key of the position, including the side to move
+ * @param out Filled with the entry if the position was found
+ * @return true if an entry for the position was found
+ */
+bool probeTransTable(hashkey key, ttentry * out)
+{
+    if (!tt_table)
+    {
+        return (false);
+    }
+
+    ttslot * slot = &tt_table[key & tt_mask];
+    uint64_t data = atomic_load_explicit(&slot->data, memory_order_relaxed);
+    uint64_t check = atomic_load_explicit(&slot->check, memory_order_relaxed);
+
+    //Different position, or torn by a racing write
+    if ((check ^ data) != key)
+    {
+        return (false);
+    }
+
+    out->key = key;
+    out->score = (int32_t) (uint32_t) data;
+    out->best = (chessmove) (data >> 32);
+    out->depth = (uint8_t) (data >> 48);
+    out->bound = (uint8_t) (data >> 56);
+
+    //Depth 0 entries are never stored, so an empty slot never matches
+    return (out->depth);
+}
+
+/*
+ * Stores a position in the transposition table. An existing entry for the
+ * same position is only replaced by a search at least as deep.
+ *
+ * @modifies tt_table
+ *
+ * @param key The key of the position, including the side to move
+ * @param depth The depth the position was searched to
+ * @param bound TT_EXACT, TT_LOWER or TT_UPPER
+ * @param score The score of the position
+ * @param best The best move found from the position, or NO_MOVE
+ */
+void storeTransTable(hashkey key, uint8_t depth, uint8_t bound, int score,
+        chessmove best)
+{
+    if (!tt_table)
+    {
+        return;
+    }
+
+    ttslot * slot = &tt_table[key & tt_mask];
+    uint64_t data = atomic_load_explicit(&slot->data, memory_order_relaxed);
+    uint64_t check = atomic_load_explicit(&slot->check, memory_order_relaxed);
+
+    //Always replace a different position, it's more likely to be useful
+    if ((check ^ data) == key && (uint8_t) (data >> 48) > depth)
+    {
+        return;
+    }
+
+    data = (uint64_t) (uint32_t) score | ((uint64_t) best << 32)
+            | ((uint64_t) depth << 48) | ((uint64_t) bound << 56);
+
+    atomic_store_explicit(&slot->data, data, memory_order_relaxed);
+    atomic_store_explicit(&slot->check, key ^ data, memory_order_relaxed);
+}
@@ -0,0 +1,100 @@
+/*
+ * ttable.h
+ *
+ * Contains the function definitions & data structures for the transposition
+ * table used by the search
+ *
+ * @author Js
+ *
+ */
+
+#ifndef TTABLE_H_
+#define TTABLE_H_
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdatomic.h>
+
+#include "common_defs.h"
+#include "board.h"
+
+//Default size of the table in megabytes, override with -DTT_SIZE_MB=<n>
+#ifndef TT_SIZE_MB
+#define TT_SIZE_MB 64
+#endif
+
+//Bound types for stored scores
+//Score is the exact value of the node
+#define TT_EXACT 0
+//Score is a lower bound, the node failed high
+#define TT_LOWER 1
+//Score is an upper bound, the node failed low
+#define TT_UPPER 2
+
+/*
+ * A single entry of the transposition table, as read out by
+ * probeTransTable()
+ */
+typedef struct
+{
+    //Full key of the stored position, used to detect index collisions
+    hashkey key;
+    //Score of the position, see bound
+    int32_t score;
+    //Best move found from the position, NO_MOVE if none
+    chessmove best;
+    //Depth the position was searched to
+    uint8_t depth;
+    //TT_EXACT, TT_LOWER or TT_UPPER
+    uint8_t bound;
+} ttentry;
+
+/*
+ * Allocates the transposition table. Any existing table is freed first.
+ *
+ * The number of entries is rounded down to a power of two so that indexing is
+ * a mask of the key.
+ *
+ * @modifies tt_table, tt_mask
+ *
+ * @param megabytes The size of the table in megabytes
+ * @return true if the table was allocated
+ */
+bool initTransTable(size_t megabytes);
+
+/*
+ * Frees the transposition table
+ *
+ * @modifies tt_table, tt_mask
+ */
+void freeTransTable(void);
+
+/*
+ * Looks up a position in the transposition table
+ *
+ * @uses tt_table, tt_mask
+ *
+ * @param key The key of the position, including the side to move
+ * @param out Filled with the entry if the position was found
+ * @return true if an entry for the position was found
+ */
+bool probeTransTable(hashkey key, ttentry * out);
+
+/*
+ * Stores a position in the transposition table. An existing entry for the
+ * same position is only replaced by a search at least as deep.
+ *
+ * @modifies tt_table
+ *
+ * @param key The key of the position, including the side to move
+ * @param depth The depth the position was searched to
+ * @param bound TT_EXACT, TT_LOWER or TT_UPPER
+ * @param score The score of the position
+ * @param best The best move found from the position, or NO_MOVE
+ */
+void storeTransTable(hashkey key, uint8_t depth, uint8_t bound, int score,
+        chessmove best);
+
+#endif /* TTABLE_H_ */